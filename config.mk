@@ -3,10 +3,25 @@ version = 0.0
 mirror = http://dl.2f30.org/morpheus-pkgs/${arch}/${version} # TODO: Change this to a mitti mirror.
 pkgdirs = $mkbuild/../ports
 nprocs = 2
+# built ports are kept here by their build key, e.g. $mkbuild/../cache,
+# empty to disable
+buildcache =
+
+# sources of all ports are kept in distfiles and copied from
+# distmirror, if set, instead of being downloaded
+distfiles = $mkbuild/../distfiles
+distmirror =
+fetchprocs = 8
 
 TOOLCHAIN_TRIPLET = ${arch}-musl-linux
-CC = ${TOOLCHAIN_TRIPLET}-gcc
-CXX = ${TOOLCHAIN_TRIPLET}-g++
+# compiler cache shared by all ports, empty to disable
+CCACHE = `{ command -v ccache || true }
+CCACHE_DIR = $mkbuild/../ccache
+CCACHE_BASEDIR = `{ cd $mkbuild/.. && pwd }
+CCACHE_COMPILERCHECK = content
+
+CC = $CCACHE ${TOOLCHAIN_TRIPLET}-gcc
+CXX = $CCACHE ${TOOLCHAIN_TRIPLET}-g++
 LD = $CC
 AR = ${TOOLCHAIN_TRIPLET}-ar
 RANLIB = ${TOOLCHAIN_TRIPLET}-ranlib
@@ -15,6 +30,8 @@ CPP = ${TOOLCHAIN_TRIPLET}-cpp
 
 HOST_TOOLCHAIN_TRIPLET = ${arch}-musl-linux
 HOSTCC = $CC -static
+# compiler for the tools mkbuild runs on the build machine
+BUILDCC = cc
 # use STRIP = true instead of the above
 # if you do not want stripped binaries
 #STRIP = true
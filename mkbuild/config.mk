@@ -1,9 +1,25 @@
 arch = x86_64
 nprocs = 2
+# built ports are kept here by their build key, empty to disable
+buildcache =
+
+# sources of all ports are kept in distfiles and copied from
+# distmirror, if set, instead of being downloaded
+distfiles = $mkbuild/../distfiles
+distmirror =
+fetchprocs = 8
 
 TOOLCHAIN_TRIPLET = ${arch}-musl-linux
-CC = ${TOOLCHAIN_TRIPLET}-gcc
+# compiler cache shared by all ports, empty to disable
+CCACHE = `{ command -v ccache || true }
+CCACHE_DIR = $mkbuild/../ccache
+CCACHE_BASEDIR = `{ cd $mkbuild/.. && pwd }
+CCACHE_COMPILERCHECK = content
+
+CC = $CCACHE ${TOOLCHAIN_TRIPLET}-gcc
 HOSTCC = $CC -static
+# compiler for the tools mkbuild runs on the build machine
+BUILDCC = cc
 LD = $CC
 AR = ${TOOLCHAIN_TRIPLET}-ar
 RANLIB = ${TOOLCHAIN_TRIPLET}-ranlib
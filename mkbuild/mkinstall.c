@@ -0,0 +1,756 @@
+/* See LICENSE file for copyright and license details. */
+/*
+ * Install the files of a port in one go.  mk.install writes one line
+ * per action to the standard input:
+ *
+ *	d mode dir		create a directory
+ *	f mode src dst		install a file
+ *	x mode src dst		install a file, strip it if it is ELF
+ *	l target path		create a symbolic link
+ *	m mode path		change the mode of a path
+ *
+ * Missing parent directories are created with mode 755.  The ELF
+ * files are stripped after everything is installed, up to jobs at
+ * once.
+ *
+ * With -a the files are not installed but packed into a gzip
+ * compressed tar archive, owned by root.  The destinations are then
+ * the paths in the archive and the ELF files are stripped into
+ * temporary copies.
+ */
+#define _GNU_SOURCE
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define COPYBUFSIZ (64 * 1024)
+#define TARBLOCK 512
+#define NHASH 4096
+
+struct entry {
+	char *path;		/* in the archive, without the leading "./" */
+	char *src;		/* file to read or target of the link */
+	char *tmp;		/* stripped copy of src */
+	mode_t mode;
+	int type;		/* 'd', 'f', 'x' or 'l' */
+	struct entry *next;
+	struct entry *hnext;	/* next entry in the same hash bucket */
+};
+
+static void eprintf(const char *, ...);
+static void weprintf(const char *, ...);
+
+static char *argv0;
+static char lastdir[PATH_MAX];	/* last directory known to exist */
+static char **strips;		/* ELF files to strip */
+static size_t nstrips;
+static char *stripargv[32];	/* strip command */
+static size_t stripargc;
+static struct entry *entries, **lastentry = &entries;
+static struct entry *entryhash[NHASH];	/* entries by path */
+static int status;
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: %s [-j jobs] [-s strip] [-a archive]\n", argv0);
+	exit(EXIT_FAILURE);
+}
+
+static void
+vwarn(const char *fmt, va_list ap)
+{
+	fprintf(stderr, "%s: ", argv0);
+	vfprintf(stderr, fmt, ap);
+	if (fmt[0] && fmt[strlen(fmt)-1] == ':') {
+		fputc(' ', stderr);
+		perror(NULL);
+	}
+}
+
+static void
+eprintf(const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	vwarn(fmt, ap);
+	va_end(ap);
+	exit(EXIT_FAILURE);
+}
+
+static void
+weprintf(const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	vwarn(fmt, ap);
+	va_end(ap);
+	status = EXIT_FAILURE;
+}
+
+/* mkdir -p, remembering the last directory so the files of one
+ * directory cost a single comparison */
+static int
+mkdirs(const char *dir, mode_t mode)
+{
+	char path[PATH_MAX], *p;
+
+	if (strcmp(dir, lastdir) == 0)
+		return 0;
+	if (strlen(dir) >= sizeof(path)) {
+		weprintf("%s: path too long\n", dir);
+		return -1;
+	}
+	strcpy(path, dir);
+	for (p = path + 1; *p; p++) {
+		if (*p != '/')
+			continue;
+		*p = '\0';
+		if (mkdir(path, 0755) < 0 && errno != EEXIST) {
+			weprintf("mkdir %s:", path);
+			return -1;
+		}
+		*p = '/';
+	}
+	if (mkdir(path, mode) < 0 && errno != EEXIST) {
+		weprintf("mkdir %s:", path);
+		return -1;
+	}
+	strcpy(lastdir, dir);
+	return 0;
+}
+
+static int
+parentdirs(const char *path)
+{
+	char dir[PATH_MAX], *p;
+
+	if (strlen(path) >= sizeof(dir)) {
+		weprintf("%s: path too long\n", path);
+		return -1;
+	}
+	strcpy(dir, path);
+	if (!(p = strrchr(dir, '/')) || p == dir)
+		return 0;
+	*p = '\0';
+	return mkdirs(dir, 0755);
+}
+
+/* Run `argv', returns its pid */
+static pid_t
+spawn(char *argv[])
+{
+	pid_t pid;
+
+	switch ((pid = fork())) {
+	case -1:
+		weprintf("fork:");
+		break;
+	case 0:
+		execvp(argv[0], argv);
+		fprintf(stderr, "%s: exec %s: %s\n", argv0, argv[0], strerror(errno));
+		_exit(127);
+	}
+	return pid;
+}
+
+static void
+reap(pid_t pid)
+{
+	int st;
+
+	if (pid < 0)
+		return;
+	if (waitpid(pid, &st, 0) < 0 || !WIFEXITED(st) || WEXITSTATUS(st) != 0)
+		status = EXIT_FAILURE;
+}
+
+/* Octal modes are set directly, anything else is left to chmod(1) */
+static void
+setmode(const char *path, const char *mode)
+{
+	char *end, *argv[] = { "chmod", (char *)mode, (char *)path, NULL };
+	long m;
+
+	m = strtol(mode, &end, 8);
+	if (*end == '\0' && end != mode) {
+		if (chmod(path, m) < 0)
+			weprintf("chmod %s:", path);
+		return;
+	}
+	reap(spawn(argv));
+}
+
+static int
+copy(int in, int out)
+{
+	char buf[COPYBUFSIZ];
+	ssize_t n, w, off;
+
+	/* in-kernel copy, and a reflink where the filesystem has them */
+	while ((n = copy_file_range(in, NULL, out, NULL, SSIZE_MAX, 0)) > 0)
+		;
+	if (n == 0)
+		return 0;
+	if (errno != EXDEV && errno != ENOSYS && errno != EINVAL &&
+	    errno != EOPNOTSUPP)
+		return -1;
+	while ((n = read(in, buf, sizeof(buf))) > 0) {
+		for (off = 0; off < n; off += w)
+			if ((w = write(out, buf + off, n - off)) < 0)
+				return -1;
+	}
+	return n < 0 ? -1 : 0;
+}
+
+static void
+install(const char *mode, const char *src, const char *dst, int strip)
+{
+	unsigned char magic[4];
+	int in, out;
+
+	printf("INSTALL %s\n", dst);
+	if (parentdirs(dst) < 0)
+		return;
+	if ((in = open(src, O_RDONLY)) < 0) {
+		weprintf("open %s:", src);
+		return;
+	}
+	/* replace rather than overwrite, the old file may be running */
+	if (unlink(dst) < 0 && errno != ENOENT)
+		weprintf("unlink %s:", dst);
+	if ((out = open(dst, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+		weprintf("open %s:", dst);
+		close(in);
+		return;
+	}
+	if (copy(in, out) < 0)
+		weprintf("copy %s:", src);
+	if (strip && pread(in, magic, sizeof(magic), 0) == sizeof(magic) &&
+	    memcmp(magic, "\177ELF", sizeof(magic)) == 0) {
+		if (!(strips = realloc(strips, (nstrips + 1) * sizeof(*strips))) ||
+		    !(strips[nstrips++] = strdup(dst)))
+			eprintf("out of memory\n");
+	}
+	close(in);
+	if (close(out) < 0)
+		weprintf("close %s:", dst);
+	setmode(dst, mode);
+}
+
+static void
+mklink(const char *target, const char *path)
+{
+	printf("LN %s %s\n", target, path);
+	if (parentdirs(path) < 0)
+		return;
+	if (unlink(path) < 0 && errno != ENOENT)
+		weprintf("unlink %s:", path);
+	if (symlink(target, path) < 0)
+		weprintf("symlink %s:", path);
+}
+
+/* Split the strip command, its arguments are separated by blanks */
+static void
+parsestrip(char *strip)
+{
+	char *p;
+
+	for (p = strtok(strip, " \t"); p; p = strtok(NULL, " \t")) {
+		if (stripargc == sizeof(stripargv) / sizeof(*stripargv) - 4)
+			eprintf("%s: too many arguments\n", strip);
+		stripargv[stripargc++] = p;
+	}
+}
+
+/* Strip the `n' files, into the files `out' if it is set, up to
+ * `jobs' at a time */
+static void
+stripall(char **files, char **out, size_t n, long jobs)
+{
+	char *argv[sizeof(stripargv) / sizeof(*stripargv)];
+	pid_t *pids;
+	size_t i, argc;
+	long running = 0;
+
+	if (stripargc == 0 || n == 0)
+		return;
+	if (!(pids = calloc(jobs, sizeof(*pids))))
+		eprintf("out of memory\n");
+	memcpy(argv, stripargv, stripargc * sizeof(*argv));
+	for (i = 0; i < n; i++) {
+		if (running == jobs)
+			reap(pids[--running]);
+		argc = stripargc;
+		if (out) {
+			argv[argc++] = "-o";
+			argv[argc++] = out[i];
+		}
+		argv[argc++] = files[i];
+		argv[argc] = NULL;
+		pids[running++] = spawn(argv);
+	}
+	while (running > 0)
+		reap(pids[--running]);
+	free(pids);
+}
+
+static char *
+estrdup(const char *s)
+{
+	char *p;
+
+	if (!(p = strdup(s)))
+		eprintf("out of memory\n");
+	return p;
+}
+
+static unsigned int
+hash(const char *s)
+{
+	unsigned int h = 2166136261u;
+
+	while (*s)
+		h = (h ^ (unsigned char)*s++) * 16777619u;
+	return h % NHASH;
+}
+
+static struct entry *
+entry_find(const char *path)
+{
+	struct entry *e;
+
+	for (e = entryhash[hash(path)]; e; e = e->hnext)
+		if (strcmp(e->path, path) == 0)
+			return e;
+	return NULL;
+}
+
+static struct entry *
+entry_add(int type, const char *path, const char *src, mode_t mode)
+{
+	struct entry *e;
+
+	if (!(e = calloc(1, sizeof(*e))))
+		eprintf("out of memory\n");
+	e->type = type;
+	e->path = estrdup(path);
+	e->src = src ? estrdup(src) : NULL;
+	e->mode = mode;
+	*lastentry = e;
+	lastentry = &e->next;
+	e->hnext = entryhash[hash(path)];
+	entryhash[hash(path)] = e;
+	return e;
+}
+
+/* Add the directories leading to `path' which are not in the
+ * archive yet */
+static void
+entry_parents(const char *path)
+{
+	char dir[PATH_MAX], *p;
+
+	if (strlen(path) >= sizeof(dir))
+		eprintf("%s: path too long\n", path);
+	strcpy(dir, path);
+	if (!(p = strrchr(dir, '/')))
+		return;
+	*p = '\0';
+	if (strcmp(dir, lastdir) == 0)
+		return;
+	strcpy(lastdir, dir);
+	for (p = dir; (p = strchr(p, '/')); *p++ = '/') {
+		*p = '\0';
+		if (!entry_find(dir))
+			entry_add('d', dir, NULL, 0755);
+	}
+	if (!entry_find(dir))
+		entry_add('d', dir, NULL, 0755);
+}
+
+/* Record an action of the manifest for the archive */
+static void
+archive_add(int type, const char *mode, const char *src, const char *dst)
+{
+	struct entry *e;
+	char *end;
+	long m;
+
+	while (*dst == '/')
+		dst++;
+	if (*dst == '\0')
+		return;
+	m = strtol(mode, &end, 8);
+	if (*end != '\0' || end == mode) {
+		weprintf("%s: only octal modes can be archived\n", mode);
+		return;
+	}
+	entry_parents(dst);
+	if ((e = entry_find(dst))) {
+		/* a later line replaces the entry, except for a chmod */
+		if (type != 'm') {
+			free(e->src);
+			e->src = src ? estrdup(src) : NULL;
+			e->type = type;
+		}
+		e->mode = m;
+		return;
+	}
+	if (type == 'm')
+		weprintf("chmod %s: not in the archive\n", dst);
+	else
+		entry_add(type, dst, src, m);
+}
+
+/* A GNU long link record, it holds a link target which does not fit
+ * into the header of the link */
+static int
+tar_longlink(FILE *fp, const char *link)
+{
+	unsigned char h[TARBLOCK];
+	unsigned int sum = 0;
+	size_t len = strlen(link) + 1, i;
+
+	memset(h, 0, sizeof(h));
+	memcpy(h, "././@LongLink", 13);
+	snprintf((char *)h + 100, 8, "%07o", 0);
+	snprintf((char *)h + 108, 8, "%07o", 0);
+	snprintf((char *)h + 116, 8, "%07o", 0);
+	snprintf((char *)h + 124, 12, "%011o", (unsigned int)len);
+	snprintf((char *)h + 136, 12, "%011o", 0);
+	h[156] = 'K';
+	memcpy(h + 257, "ustar  ", 8);
+	memset(h + 148, ' ', 8);
+	for (i = 0; i < sizeof(h); i++)
+		sum += h[i];
+	snprintf((char *)h + 148, 8, "%06o", sum);
+	h[155] = ' ';
+	if (fwrite(h, 1, sizeof(h), fp) != sizeof(h) || fwrite(link, 1, len, fp) != len)
+		return -1;
+	memset(h, 0, sizeof(h));
+	if (len % TARBLOCK && fwrite(h, 1, TARBLOCK - len % TARBLOCK, fp) != TARBLOCK - len % TARBLOCK)
+		return -1;
+	return 0;
+}
+
+static int
+tar_header(FILE *fp, const char *path, int type, mode_t mode, off_t size,
+           time_t mtime, const char *link)
+{
+	unsigned char h[TARBLOCK];
+	char name[PATH_MAX + 3];
+	unsigned int sum = 0;
+	size_t len, i;
+	char *p;
+
+	snprintf(name, sizeof(name), "./%s%s", path, type == '5' && *path ? "/" : "");
+	len = strlen(name);
+	memset(h, 0, sizeof(h));
+	if (len <= 100) {
+		memcpy(h, name, len);
+	} else {
+		/* ustar splits long names at a slash into prefix and name */
+		for (p = name + len - 1; p > name && (*p != '/' || p - name > 155 ||
+		     len - (p - name) - 1 > 100 || p[1] == '\0'); p--)
+			;
+		if (p == name) {
+			weprintf("%s: name too long for the archive\n", path);
+			return -1;
+		}
+		memcpy(h + 345, name, p - name);
+		memcpy(h, p + 1, len - (p - name) - 1);
+	}
+	if (link && strlen(link) > 100 && tar_longlink(fp, link) < 0)
+		return -1;
+	snprintf((char *)h + 100, 8, "%07o", (unsigned int)(mode & 07777));
+	snprintf((char *)h + 108, 8, "%07o", 0);
+	snprintf((char *)h + 116, 8, "%07o", 0);
+	snprintf((char *)h + 124, 12, "%011llo", (unsigned long long)size);
+	snprintf((char *)h + 136, 12, "%011llo", (unsigned long long)mtime);
+	h[156] = type;
+	if (link)
+		memcpy(h + 157, link, strlen(link) > 100 ? 100 : strlen(link));
+	memcpy(h + 257, "ustar", 6);
+	memcpy(h + 263, "00", 2);
+	memcpy(h + 265, "root", 4);
+	memcpy(h + 297, "root", 4);
+	memset(h + 148, ' ', 8);
+	for (i = 0; i < sizeof(h); i++)
+		sum += h[i];
+	snprintf((char *)h + 148, 8, "%06o", sum);
+	h[155] = ' ';
+	return fwrite(h, 1, sizeof(h), fp) == sizeof(h) ? 0 : -1;
+}
+
+static int
+tar_file(FILE *fp, struct entry *e)
+{
+	char buf[COPYBUFSIZ];
+	const char *src = e->tmp ? e->tmp : e->src;
+	struct stat sb;
+	off_t left;
+	ssize_t n;
+	int fd, r = 0;
+
+	if ((fd = open(src, O_RDONLY)) < 0 || fstat(fd, &sb) < 0) {
+		weprintf("open %s:", src);
+		if (fd >= 0)
+			close(fd);
+		return -1;
+	}
+	if (tar_header(fp, e->path, '0', e->mode, sb.st_size, sb.st_mtime, NULL) < 0) {
+		close(fd);
+		return -1;
+	}
+	/* the size is in the header already, pad or cut to it */
+	for (left = sb.st_size; left > 0; left -= n) {
+		if ((n = read(fd, buf, left < (off_t)sizeof(buf) ? left : (off_t)sizeof(buf))) <= 0) {
+			weprintf("read %s: file changed\n", src);
+			memset(buf, 0, sizeof(buf));
+			n = left < (off_t)sizeof(buf) ? left : (off_t)sizeof(buf);
+			r = -1;
+		}
+		fwrite(buf, 1, n, fp);
+	}
+	memset(buf, 0, TARBLOCK);
+	if (sb.st_size % TARBLOCK)
+		fwrite(buf, 1, TARBLOCK - sb.st_size % TARBLOCK, fp);
+	close(fd);
+	return r;
+}
+
+/* Strip the ELF files into temporary copies, they replace the files
+ * in the archive */
+static void
+archive_strip(long jobs)
+{
+	unsigned char magic[4];
+	struct entry *e;
+	struct stat sb;
+	char **files = NULL, **out = NULL, tmp[PATH_MAX];
+	const char *dir;
+	size_t n = 0;
+	int fd, tfd;
+
+	if (!(dir = getenv("TMPDIR")) || !*dir)
+		dir = "/tmp";
+	for (e = entries; e; e = e->next) {
+		if (e->type != 'x' || (fd = open(e->src, O_RDONLY)) < 0)
+			continue;
+		if (read(fd, magic, sizeof(magic)) == sizeof(magic) &&
+		    memcmp(magic, "\177ELF", sizeof(magic)) == 0) {
+			if (snprintf(tmp, sizeof(tmp), "%s/mkinstall.XXXXXX",
+			    dir) >= (int)sizeof(tmp)) {
+				weprintf("%s: path too long\n", dir);
+				close(fd);
+				continue;
+			}
+			if ((tfd = mkstemp(tmp)) < 0) {
+				weprintf("mkstemp %s:", dir);
+				close(fd);
+				continue;
+			}
+			close(tfd);
+			e->tmp = estrdup(tmp);
+			if (!(files = realloc(files, (n + 1) * sizeof(*files))) ||
+			    !(out = realloc(out, (n + 1) * sizeof(*out))))
+				eprintf("out of memory\n");
+			files[n] = e->src;
+			out[n++] = e->tmp;
+		}
+		close(fd);
+	}
+	stripall(files, out, n, jobs);
+	/* a strip which does not write the copy leaves the file as is */
+	for (e = entries; e; e = e->next) {
+		if (e->tmp && stat(e->tmp, &sb) == 0 && sb.st_size == 0) {
+			unlink(e->tmp);
+			free(e->tmp);
+			e->tmp = NULL;
+		}
+	}
+	free(files);
+	free(out);
+}
+
+/* Write the archive through gzip(1), into a temporary file which is
+ * renamed when complete */
+static void
+archive_write(const char *archive)
+{
+	struct entry *e;
+	FILE *fp;
+	char tmp[PATH_MAX], zero[2 * TARBLOCK];
+	time_t now = time(NULL);
+	int pfd[2], out, r = 0;
+	pid_t pid;
+
+	if (snprintf(tmp, sizeof(tmp), "%s.%ld", archive, (long)getpid()) >= (int)sizeof(tmp))
+		eprintf("%s: path too long\n", archive);
+	if ((out = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+		eprintf("open %s:", tmp);
+	if (pipe(pfd) < 0)
+		eprintf("pipe:");
+	fflush(stdout);
+	switch ((pid = fork())) {
+	case -1:
+		eprintf("fork:");
+		break;
+	case 0:
+		dup2(pfd[0], 0);
+		dup2(out, 1);
+		close(pfd[0]);
+		close(pfd[1]);
+		close(out);
+		execlp("gzip", "gzip", "-c", (char *)NULL);
+		fprintf(stderr, "%s: exec gzip: %s\n", argv0, strerror(errno));
+		_exit(127);
+	}
+	close(pfd[0]);
+	close(out);
+	if (!(fp = fdopen(pfd[1], "w")))
+		eprintf("fdopen:");
+
+	r |= tar_header(fp, "", '5', 0755, 0, now, NULL);
+	for (e = entries; e; e = e->next) {
+		switch (e->type) {
+		case 'd':
+			printf("MKDIR %s\n", e->path);
+			r |= tar_header(fp, e->path, '5', e->mode, 0, now, NULL);
+			break;
+		case 'l':
+			printf("LN %s %s\n", e->src, e->path);
+			r |= tar_header(fp, e->path, '2', 0777, 0, now, e->src);
+			break;
+		default:
+			printf("PACK %s\n", e->path);
+			r |= tar_file(fp, e);
+			break;
+		}
+		if (e->tmp)
+			unlink(e->tmp);
+	}
+	memset(zero, 0, sizeof(zero));
+	fwrite(zero, 1, sizeof(zero), fp);
+	if (fclose(fp) == EOF) {
+		weprintf("write %s:", tmp);
+		r = -1;
+	}
+	reap(pid);
+	if (r < 0 || status != EXIT_SUCCESS) {
+		status = EXIT_FAILURE;
+		unlink(tmp);
+	} else if (rename(tmp, archive) < 0) {
+		weprintf("rename %s:", tmp);
+		unlink(tmp);
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	char line[3 * PATH_MAX], orig[3 * PATH_MAX], *f[4], *archive = NULL, *end;
+	long jobs = 1;
+	size_t len;
+	int n, c;
+
+	argv0 = argv[0];
+	while ((c = getopt(argc, argv, "a:j:s:")) != -1) {
+		switch (c) {
+		case 'a':
+			archive = optarg;
+			break;
+		case 'j':
+			jobs = strtol(optarg, &end, 10);
+			if (*end || jobs < 1)
+				usage();
+			break;
+		case 's':
+			parsestrip(optarg);
+			break;
+		default:
+			usage();
+		}
+	}
+	if (optind != argc)
+		usage();
+
+	while (fgets(line, sizeof(line), stdin)) {
+		len = strlen(line);
+		if (len > 0 && line[len - 1] == '\n')
+			line[len - 1] = '\0';
+		/* strtok() cuts line, keep it whole for errors */
+		memcpy(orig, line, strlen(line) + 1);
+		for (n = 0; n < 4 && (f[n] = strtok(n ? NULL : line, " \t")); n++)
+			;
+		if (n == 0)
+			continue;
+		switch (strlen(f[0]) == 1 ? f[0][0] : '?') {
+		case 'd':
+			if (n != 3)
+				goto bad;
+			if (archive) {
+				archive_add('d', f[1], NULL, f[2]);
+				break;
+			}
+			printf("MKDIR %s\n", f[2]);
+			if (mkdirs(f[2], 0755) == 0)
+				setmode(f[2], f[1]);
+			break;
+		case 'f':
+		case 'x':
+			if (n != 4)
+				goto bad;
+			if (archive)
+				archive_add(f[0][0], f[1], f[2], f[3]);
+			else
+				install(f[1], f[2], f[3], f[0][0] == 'x');
+			break;
+		case 'l':
+			if (n != 3)
+				goto bad;
+			if (archive)
+				archive_add('l', "777", f[1], f[2]);
+			else
+				mklink(f[1], f[2]);
+			break;
+		case 'm':
+			if (n != 3)
+				goto bad;
+			if (archive) {
+				archive_add('m', f[1], NULL, f[2]);
+				break;
+			}
+			printf("CHMOD %s %s\n", f[1], f[2]);
+			setmode(f[2], f[1]);
+			break;
+		default:
+		bad:
+			weprintf("bad line: %s\n", orig);
+			break;
+		}
+	}
+	fflush(stdout);
+
+	if (archive) {
+		archive_strip(jobs);
+		archive_write(archive);
+	} else {
+		stripall(strips, NULL, nstrips, jobs);
+	}
+
+	return status;
+}
@@ -0,0 +1,112 @@
+#!/bin/sh
+#
+# Synthetic-scale benchmark for pkgtools.
+#
+# Generates `pkgs' packages of `files' files each, nested `depth'
+# directories deep, installs them into a scratch root with `rules'
+# reject.conf rules, and times installpkg, collision checks, infopkg -o
+# and removepkg -f.  Results are printed as JSON lines, one per step,
+# followed by the per-phase lines of PKGTOOLS_TIMING=json (db_load
+# is reported as a phase of every step).
+#
+# usage: bench.sh [-p pkgs] [-f files] [-d depth] [-r rules] [-w workdir]
+
+pkgs=100
+files=100
+depth=4
+rules=8
+work=
+
+usage() {
+	echo "usage: $(basename $0) [-p pkgs] [-f files] [-d depth] [-r rules] [-w workdir]" 1>&2
+	exit 1
+}
+
+while getopts p:f:d:r:w: opt; do
+	case $opt in
+	p) pkgs=$OPTARG ;;
+	f) files=$OPTARG ;;
+	d) depth=$OPTARG ;;
+	r) rules=$OPTARG ;;
+	w) work=$OPTARG ;;
+	*) usage ;;
+	esac
+done
+
+bin=$(cd "$(dirname "$0")" && pwd)
+keep=1
+if test -z "$work"; then
+	work=$(mktemp -d "${TMPDIR:-/tmp}/pkgbench.XXXXXX")
+	keep=0
+fi
+root="$work/root"
+src="$work/pkgs"
+log="$work/timing"
+params="\"pkgs\":$pkgs,\"files\":$files,\"depth\":$depth,\"rules\":$rules"
+
+set -e
+rm -rf "$root" "$src"
+mkdir -p "$root/var/pkg" "$root/etc/pkgtools" "$src"
+
+# reject rules which never match, so only their cost is measured
+i=0
+while test $i -lt $rules; do
+	echo "^nonexistent$i/" >> "$root/etc/pkgtools/reject.conf"
+	i=$((i + 1))
+done
+
+# synthetic archives
+i=0
+while test $i -lt $pkgs; do
+	stage="$work/stage"
+	rm -rf "$stage"
+	mkdir -p "$stage"
+	awk -v p=$i -v n=$files -v d=$depth 'BEGIN {
+		dir = "usr/share/bench" p
+		for (j = 0; j < d; j++)
+			dir = dir "/d" j
+		for (j = 0; j < n; j++)
+			print dir "/f" j
+	}' > "$work/list"
+	(cd "$stage" && sed 's,/[^/]*$,,' "$work/list" | sort -u | xargs mkdir -p &&
+		xargs touch < "$work/list" && echo bench$i > "$(head -n 1 "$work/list")")
+	tar -zcf "$src/bench$i#1.0.pkg.tgz" -C "$stage" .
+	i=$((i + 1))
+done
+rm -rf "$stage" "$work/list"
+
+now() {
+	date +%s.%N
+}
+
+# run <step> <status> <cmd...>: time a command and report its phases
+# and exit status, which is expected to be <status>
+failed=0
+run() {
+	step=$1
+	want=$2
+	shift 2
+	t0=$(now)
+	st=0
+	PKGTOOLS_TIMING=json "$@" 2> "$log" > /dev/null || st=$?
+	t1=$(now)
+	echo "{\"bench\":\"$step\",$params,\"status\":$st,\"wall\":$(echo "$t1 $t0" | awk '{ printf("%.6f", $1 - $2) }')}"
+	grep '^{' "$log" | sed "s/^{/{\"bench\":\"$step\",/"
+	if test $st -ne $want; then
+		echo "$step: exit status $st, expected $want" 1>&2
+		grep -v '^{' "$log" 1>&2 || true
+		failed=1
+	fi
+}
+
+run installpkg 0 "$bin/installpkg" -r "$root" "$src"/*.pkg.tgz
+# another version of an installed package, refused since its files
+# are those of the installed version
+cp "$src/bench0#1.0.pkg.tgz" "$work/bench0#1.1.pkg.tgz"
+run collisions 1 "$bin/installpkg" -r "$root" "$work/bench0#1.1.pkg.tgz"
+run infopkg 0 "$bin/infopkg" -r "$root" -o "$(find "$root/usr/share/bench0" -type f | head -n 1)"
+run removepkg 0 "$bin/removepkg" -f -r "$root" $(i=0; while test $i -lt $pkgs; do echo bench$i; i=$((i + 1)); done)
+
+rm -rf "$root" "$src" "$log" "$work/bench0#1.1.pkg.tgz"
+test $keep -eq 1 || rmdir "$work"
+exit $failed
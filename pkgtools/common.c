@@ -1,8 +1,9 @@
 /* See LICENSE file for copyright and license details. */
+#include <ctype.h>
 #include "pkg.h"
 
 /* Extract the package name from a filename.  e.g. /tmp/pkg#version.pkg.tgz */
-void
+int
 parse_name(const char *path, char **name)
 {
 	char tmp[PATH_MAX], filename[PATH_MAX], *p;
@@ -25,14 +26,15 @@ parse_name(const char *path, char **name)
 	if (filename[0] == '\0')
 		goto err;
 	*name = estrdup(filename);
-	return;
+	return 0;
 err:
-	eprintf("%s: invalid package filename\n",
-		path);
+	weprintf("%s: invalid package filename\n",
+		 path);
+	return -1;
 }
 
 /* Extract the package version from a filename.  e.g. /tmp/pkg#version.pkg.tgz */
-void
+int
 parse_version(const char *path, char **version)
 {
 	char tmp[PATH_MAX], filename[PATH_MAX], *p;
@@ -52,16 +54,17 @@ parse_version(const char *path, char **version)
 	p = strchr(filename, '#');
 	if (!p) {
 		*version = NULL;
-		return;
+		return 0;
 	}
 	p++;
 	if (*p == '\0')
 		goto err;
 	*version = estrdup(p);
-	return ;
+	return 0;
 err:
-	eprintf("%s: invalid package filename\n",
-		path);
+	weprintf("%s: invalid package filename\n",
+		 path);
+	return -1;
 }
 
 void
@@ -90,3 +93,59 @@ parse_db_version(const char *path, char **version)
 	else
 		*version = NULL;
 }
+
+/* Compare the versions `a' and `b'.  They are split into runs of
+ * digits and of letters, anything else separates runs.  Numeric runs
+ * compare by value and are newer than alphabetic ones, so that
+ * 1.10 > 1.9 and 1.0.1 > 1.0a.  Returns <0, 0 or >0 like strcmp(). */
+int
+vercmp(const char *a, const char *b)
+{
+	const char *p, *q;
+	size_t la, lb;
+	int num, r;
+
+	while (*a && *b) {
+		while (*a && !isalnum((unsigned char)*a))
+			a++;
+		while (*b && !isalnum((unsigned char)*b))
+			b++;
+		if (!*a || !*b)
+			break;
+
+		num = !!isdigit((unsigned char)*a);
+		if (num != !!isdigit((unsigned char)*b))
+			return num ? 1 : -1;
+		if (num) {
+			while (*a == '0')
+				a++;
+			while (*b == '0')
+				b++;
+			for (p = a; isdigit((unsigned char)*p); p++)
+				;
+			for (q = b; isdigit((unsigned char)*q); q++)
+				;
+		} else {
+			for (p = a; isalpha((unsigned char)*p); p++)
+				;
+			for (q = b; isalpha((unsigned char)*q); q++)
+				;
+		}
+		la = p - a;
+		lb = q - b;
+		/* longer numbers without leading zeros are larger */
+		if (num && la != lb)
+			return la < lb ? -1 : 1;
+		if ((r = strncmp(a, b, la < lb ? la : lb)) != 0)
+			return r;
+		if (la != lb)
+			return la < lb ? -1 : 1;
+		a = p;
+		b = q;
+	}
+	while (*a && !isalnum((unsigned char)*a))
+		a++;
+	while (*b && !isalnum((unsigned char)*b))
+		b++;
+	return (*a != '\0') - (*b != '\0');
+}
@@ -0,0 +1,113 @@
+/* See LICENSE file for copyright and license details. */
+#include "pkg.h"
+
+/*
+ * Compact db record format.  After the COMPACTMAGIC header the
+ * relative paths of the package are stored sorted and front coded:
+ * for each path the length of the prefix shared with the previous
+ * path and the length of the remaining suffix are written as LEB128
+ * varints, followed by the suffix bytes.  Sorting keeps directories
+ * in front of their contents, which pkg_remove() relies on when it
+ * walks the entries in reverse.
+ */
+
+static int
+cmp(const void *a, const void *b)
+{
+	return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static void
+putvar(FILE *fp, size_t n)
+{
+	while (n >= 0x80) {
+		fputc((n & 0x7f) | 0x80, fp);
+		n >>= 7;
+	}
+	fputc(n, fp);
+}
+
+static int
+getvar(const unsigned char **p, const unsigned char *end, size_t *n)
+{
+	int shift = 0;
+
+	*n = 0;
+	while (*p < end && shift < 28) {
+		*n |= (size_t)(**p & 0x7f) << shift;
+		if (!(*(*p)++ & 0x80))
+			return 0;
+		shift += 7;
+	}
+	return -1;
+}
+
+/* Write the entries of `pkg' to `fp' in the compact format */
+int
+compact_write(FILE *fp, struct pkg *pkg)
+{
+	struct pkgentry *pe;
+	char **paths;
+	const char *prev = "";
+	size_t n = 0, i, lcp, len;
+
+	TAILQ_FOREACH(pe, &pkg->pe_head, entry)
+		n++;
+	paths = ecalloc(n ? n : 1, sizeof(*paths));
+	i = 0;
+	TAILQ_FOREACH(pe, &pkg->pe_head, entry)
+		paths[i++] = pe->rpath;
+	qsort(paths, n, sizeof(*paths), cmp);
+
+	fwrite(COMPACTMAGIC, 1, sizeof(COMPACTMAGIC) - 1, fp);
+	for (i = 0; i < n; i++) {
+		for (lcp = 0; prev[lcp] && prev[lcp] == paths[i][lcp]; lcp++)
+			;
+		len = strlen(paths[i] + lcp);
+		putvar(fp, lcp);
+		putvar(fp, len);
+		fwrite(paths[i] + lcp, 1, len, fp);
+		prev = paths[i];
+	}
+	free(paths);
+
+	return ferror(fp) ? -1 : 0;
+}
+
+/* Check whether the `len' bytes in `buf' start a compact record */
+int
+compact_magic(const char *buf, size_t len)
+{
+	return len >= sizeof(COMPACTMAGIC) - 1 &&
+	       memcmp(buf, COMPACTMAGIC, sizeof(COMPACTMAGIC) - 1) == 0;
+}
+
+/* Decode the compact record in `buf' and add its entries to `pkg' */
+int
+compact_read(struct db *db, struct pkg *pkg, const char *buf, size_t len)
+{
+	const unsigned char *p, *end;
+	struct pkgentry *pe;
+	char path[PATH_MAX];
+	size_t cur = 0, lcp, sfx;
+
+	p = (const unsigned char *)buf + sizeof(COMPACTMAGIC) - 1;
+	end = (const unsigned char *)buf + len;
+	while (p < end) {
+		if (getvar(&p, end, &lcp) < 0 || getvar(&p, end, &sfx) < 0 ||
+		    lcp > cur || lcp + sfx >= sizeof(path) ||
+		    sfx > (size_t)(end - p) || lcp + sfx == 0) {
+			weprintf("%s: malformed pkg file\n", pkg->path);
+			return -1;
+		}
+		memcpy(path + lcp, p, sfx);
+		p += sfx;
+		cur = lcp + sfx;
+		path[cur] = '\0';
+		if (!(pe = pkgentry_new(db, path)))
+			return -1;
+		TAILQ_INSERT_TAIL(&pkg->pe_head, pe, entry);
+	}
+
+	return 0;
+}
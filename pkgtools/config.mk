@@ -1,9 +1,16 @@
 VERSION = 0.4.1
+SOVERSION = 0
 
 PREFIX = /usr/local
 
 CC = gcc
 LD = $(CC)
 CPPFLAGS = -D_BSD_SOURCE -D_GNU_SOURCE -DVERSION=\"${VERSION}\" -D_LARGEFILE_SOURCE -D_FILE_OFFSET_BITS=64
-CFLAGS   = -O2 -std=c99 -Wall -Wextra -pedantic $(CPPFLAGS)
+CFLAGS   = -O2 -std=c99 -Wall -Wextra -pedantic -fPIC $(CPPFLAGS)
 LDFLAGS  = -s -larchive
+
+# make bench
+BENCH_PKGS  = 100
+BENCH_FILES = 100
+BENCH_DEPTH = 4
+BENCH_RULES = 8
@@ -1,6 +1,7 @@
 /* See LICENSE file for copyright and license details. */
 #include "pkg.h"
 
+int cflag = 0;
 int fflag = 0;
 int vflag = 0;
 
@@ -8,7 +9,6 @@ struct db *
 db_new(const char *root)
 {
 	struct db *db;
-	struct sigaction sa;
 
 	db = emalloc(sizeof(*db));
 	TAILQ_INIT(&db->pkg_head);
@@ -20,8 +20,12 @@ db_new(const char *root)
 		return NULL;
 	}
 
-	estrlcpy(db->path, db->root, sizeof(db->path));
-	estrlcat(db->path, DBPATH, sizeof(db->path));
+	if (strlcpy(db->path, db->root, sizeof(db->path)) >= sizeof(db->path) ||
+	    strlcat(db->path, DBPATH, sizeof(db->path)) >= sizeof(db->path)) {
+		weprintf("%s: path too long\n", root);
+		free(db);
+		return NULL;
+	}
 
 	db->pkgdir = opendir(db->path);
 	if (!db->pkgdir) {
@@ -32,6 +36,17 @@ db_new(const char *root)
 
 	TAILQ_INIT(&db->rejrule_head);
 	rej_load(db);
+	db->names = htab_new(256);
+
+	return db;
+}
+
+/* Ignore the usual termination signals so that an interrupted
+ * installpkg or removepkg does not leave the db half updated */
+void
+db_sigignore(void)
+{
+	struct sigaction sa;
 
 	memset(&sa, 0, sizeof(sa));
 	sa.sa_handler = SIG_IGN;
@@ -39,8 +54,6 @@ db_new(const char *root)
 	sigaction(SIGINT, &sa, 0);
 	sigaction(SIGQUIT, &sa, 0);
 	sigaction(SIGTERM, &sa, 0);
-
-	return db;
 }
 
 int
@@ -62,86 +75,276 @@ db_free(struct db *db)
 
 	closedir(db->pkgdir);
 	rej_free(db);
+	htab_free(db->names);
 	free(db);
 	return 0;
 }
 
+/* Build the path of the metadata file for the db record `file' */
+static int
+db_meta_path(struct db *db, const char *file, char *path, size_t sz)
+{
+	const char *p;
+
+	if ((p = strrchr(file, '/')))
+		file = p + 1;
+	strlcpy(path, db->path, sz);
+	strlcat(path, "/" DBPATHMETA "/", sz);
+	if (strlcat(path, file, sz) >= sz) {
+		weprintf("%s: path too long\n", file);
+		return -1;
+	}
+	return 0;
+}
+
+/* Record the package metadata (dependencies and installed size)
+ * next to the db entry */
+static int
+db_meta_add(struct db *db, struct pkg *pkg, const char *file)
+{
+	char path[PATH_MAX];
+	struct pkgdep *pd;
+	FILE *fp;
+
+	if (TAILQ_EMPTY(&pkg->pd_head) && pkg->size < 0)
+		return 0;
+
+	estrlcpy(path, db->path, sizeof(path));
+	estrlcat(path, "/" DBPATHMETA, sizeof(path));
+	if (mkdir(path, 0755) < 0 && errno != EEXIST) {
+		weprintf("mkdir %s:", path);
+		return -1;
+	}
+
+	if (db_meta_path(db, file, path, sizeof(path)) < 0)
+		return -1;
+	if (!(fp = fopen(path, "w"))) {
+		weprintf("fopen %s:", path);
+		return -1;
+	}
+	TAILQ_FOREACH(pd, &pkg->pd_head, entry)
+		fprintf(fp, "dep %s\n", pd->name);
+	if (pkg->size >= 0)
+		fprintf(fp, "size %lld\n", (long long)pkg->size);
+	fflush(fp);
+	prof_begin(PROF_FSYNC);
+	if (fsync(fileno(fp)) < 0)
+		weprintf("fsync %s:", path);
+	prof_end(PROF_FSYNC);
+	fclose(fp);
+
+	return 0;
+}
+
+/* Load the package metadata recorded by db_add(), if any */
 int
-db_add(struct db *db, struct pkg *pkg)
+db_meta_load(struct db *db, struct pkg *pkg)
 {
 	char path[PATH_MAX];
-	char *name, *version;
+	struct pkgdep *pd;
+	FILE *fp;
+	char *buf = NULL, *key, *val;
+	size_t sz = 0;
+	ssize_t len;
+
+	if (db_meta_path(db, pkg->path, path, sizeof(path)) < 0)
+		return -1;
+	if (!(fp = fopen(path, "r"))) {
+		if (errno == ENOENT)
+			return 0;
+		weprintf("fopen %s:", path);
+		return -1;
+	}
+
+	while ((len = getline(&buf, &sz, fp)) != -1) {
+		if (len > 0 && buf[len - 1] == '\n')
+			buf[len - 1] = '\0';
+		key = strtok(buf, " \t");
+		val = strtok(NULL, " \t");
+		if (!key || !val)
+			continue;
+		if (strcmp(key, "dep") == 0) {
+			pd = pkgdep_new(val);
+			TAILQ_INSERT_TAIL(&pkg->pd_head, pd, entry);
+		} else if (strcmp(key, "size") == 0) {
+			pkg->size = strtoll(val, NULL, 10);
+		}
+	}
+
+	if (ferror(fp)) {
+		weprintf("%s: read error:", path);
+		free(buf);
+		fclose(fp);
+		return -1;
+	}
+
+	free(buf);
+	fclose(fp);
+
+	return 0;
+}
+
+int
+db_add(struct db *db, struct pkg *pkg)
+{
+	char path[PATH_MAX], epath[PATH_MAX];
 	struct pkgentry *pe;
 	FILE *fp;
+	int r;
 
-	parse_name(pkg->path, &name);
-	parse_version(pkg->path, &version);
+	prof_begin(PROF_DB_ADD);
 	estrlcpy(path, db->path, sizeof(path));
 	estrlcat(path, "/", sizeof(path));
-	estrlcat(path, name, sizeof(path));
-	if (version) {
+	estrlcat(path, pkg->name, sizeof(path));
+	if (pkg->version) {
 		estrlcat(path, "#", sizeof(path));
-		estrlcat(path, version, sizeof(path));
+		estrlcat(path, pkg->version, sizeof(path));
 	}
-	free(name);
-	free(version);
 
 	if (!(fp = fopen(path, "w"))) {
 		weprintf("fopen %s:", path);
+		prof_end(PROF_DB_ADD);
 		return -1;
 	}
 
 	TAILQ_FOREACH(pe, &pkg->pe_head, entry) {
-		if (vflag == 1)
-			printf("installed %s\n", pe->path);
-		fputs(pe->rpath, fp);
-		fputc('\n', fp);
+		if (vflag == 1) {
+			db_entry_path(db, pe->rpath, epath, sizeof(epath));
+			printf("installed %s\n", epath);
+		}
+		if (cflag == 0) {
+			fputs(pe->rpath, fp);
+			fputc('\n', fp);
+		}
+	}
+	/* a partial record would be misparsed by db_load() */
+	if ((cflag == 1 && compact_write(fp, pkg) < 0) ||
+	    fflush(fp) == EOF || ferror(fp)) {
+		weprintf("fwrite %s:", path);
+		fclose(fp);
+		remove(path);
+		prof_end(PROF_DB_ADD);
+		return -1;
 	}
 
 	if (vflag == 1)
 		printf("adding %s\n", path);
-	fflush(fp);
+	prof_begin(PROF_FSYNC);
 	if (fsync(fileno(fp)) < 0)
 		weprintf("fsync %s:", path);
+	prof_end(PROF_FSYNC);
 	fclose(fp);
 
-	return 0;
+	r = db_meta_add(db, pkg, path);
+	prof_end(PROF_DB_ADD);
+	return r;
 }
 
 int
 db_rm(struct db *db, struct pkg *pkg)
 {
-	(void) db;
+	char path[PATH_MAX];
 
+	prof_begin(PROF_DB_RM);
 	if (vflag == 1)
 		printf("removing %s\n", pkg->path);
 	if (remove(pkg->path) < 0) {
 		weprintf("remove %s:", pkg->path);
+		prof_end(PROF_DB_RM);
 		return -1;
 	}
-	sync();
+	if (db_meta_path(db, pkg->path, path, sizeof(path)) == 0 &&
+	    remove(path) < 0 && errno != ENOENT)
+		weprintf("remove %s:", path);
+	prof_end(PROF_DB_RM);
 	return 0;
 }
 
+/* Commit the removals of a batch of db_rm() calls */
+void
+db_sync(struct db *db)
+{
+	(void) db;
+
+	prof_begin(PROF_FSYNC);
+	sync();
+	prof_end(PROF_FSYNC);
+}
+
 int
 db_load(struct db *db)
 {
 	struct pkg *pkg;
 	struct dirent *dp;
 
+	prof_begin(PROF_DB_LOAD);
 	while ((dp = readdir(db->pkgdir))) {
-		if (strcmp(dp->d_name, ".") == 0 ||
-		    strcmp(dp->d_name, "..") == 0)
+		/* skip ".", "..", private subdirectories such as DBPATHMETA
+		 * and the object store */
+		if (dp->d_name[0] == '.' || strcmp(dp->d_name, DBPATHOBJECTS) == 0)
 			continue;
 		pkg = pkg_load(db, dp->d_name);
-		if (!pkg)
+		if (!pkg) {
+			prof_end(PROF_DB_LOAD);
 			return -1;
+		}
 		TAILQ_INSERT_TAIL(&db->pkg_head, pkg, entry);
+		htab_add(db->names, pkg->name, pkg);
 	}
+	prof_end(PROF_DB_LOAD);
 
 	return 0;
 }
 
+/* Return the installed package called `name' with version `version',
+ * or with any version if `version' is NULL */
+struct pkg *
+db_find(struct db *db, const char *name, const char *version)
+{
+	struct hent *he;
+	struct pkg *pkg;
+
+	for (he = htab_get(db->names, name); he; he = htab_next(he)) {
+		pkg = he->val;
+		if (!version || (pkg->version && strcmp(pkg->version, version) == 0))
+			return pkg;
+	}
+	return NULL;
+}
+
+/* Build the absolute path of the relative entry `rpath' below the
+ * db root, in the same form pkgentry_new() uses */
+void
+db_entry_path(struct db *db, const char *rpath, char *path, size_t sz)
+{
+	estrlcpy(path, db->root, sz);
+	estrlcat(path, "/", sz);
+	estrlcat(path, rpath, sz);
+}
+
+/* Convert the absolute path `path' to the form package entries use
+ * for their `path' member, i.e. <root>/<rpath> */
+int
+db_path_key(struct db *db, const char *path, char *key, size_t sz)
+{
+	size_t len = strlen(db->root);
+
+	if (path[0] != '/')
+		return -1;
+	if (strcmp(db->root, "/") == 0)
+		path++;
+	else if (strncmp(path, db->root, len) == 0 && path[len] == '/')
+		path += len + 1;
+	else
+		return -1;
+
+	strlcpy(key, db->root, sz);
+	strlcat(key, "/", sz);
+	if (strlcat(key, path, sz) >= sz)
+		return -1;
+	return 0;
+}
+
 /* Walk through all packages in the db and call `cb' for each one */
 int
 db_walk(struct db *db, int (*cb)(struct db *, struct pkg *, void *), void *data)
@@ -159,18 +362,3 @@ db_walk(struct db *db, int (*cb)(struct db *, struct pkg *, void *), void *data)
 	}
 	return 0;
 }
-
-/* Return the number of packages that have references to the given path */
-int
-db_links(struct db *db, const char *path)
-{
-	struct pkg *pkg;
-	struct pkgentry *pe;
-	int links = 0;
-
-	TAILQ_FOREACH(pkg, &db->pkg_head, entry)
-		TAILQ_FOREACH(pe, &pkg->pe_head, entry)
-			if (strcmp(pe->path, path) == 0)
-				links++;
-	return links;
-}
@@ -0,0 +1,129 @@
+/* See LICENSE file for copyright and license details. */
+#include "pkg.h"
+
+/* FNV-1a */
+static size_t
+htab_hash(const char *key)
+{
+	unsigned long long h = 14695981039346656037ULL;
+
+	for (; *key; key++) {
+		h ^= (unsigned char)*key;
+		h *= 1099511628211ULL;
+	}
+	return (size_t)h;
+}
+
+static void
+htab_grow(struct htab *h)
+{
+	struct hent **tab, *he, *tmp;
+	size_t i, sz, b;
+
+	sz = h->sz * 2;
+	tab = ecalloc(sz, sizeof(*tab));
+	for (i = 0; i < h->sz; i++) {
+		for (he = h->tab[i]; he; he = tmp) {
+			tmp = he->next;
+			b = htab_hash(he->key) & (sz - 1);
+			he->next = tab[b];
+			tab[b] = he;
+		}
+	}
+	free(h->tab);
+	h->tab = tab;
+	h->sz = sz;
+}
+
+/* Create a hash table with at least `sz' buckets.  Keys are not
+ * copied and must outlive their entries. */
+struct htab *
+htab_new(size_t sz)
+{
+	struct htab *h;
+	size_t n = 16;
+
+	while (n < sz)
+		n *= 2;
+	h = emalloc(sizeof(*h));
+	h->tab = ecalloc(n, sizeof(*h->tab));
+	h->sz = n;
+	h->n = 0;
+	return h;
+}
+
+void
+htab_free(struct htab *h)
+{
+	struct hent *he, *tmp;
+	size_t i;
+
+	for (i = 0; i < h->sz; i++) {
+		for (he = h->tab[i]; he; he = tmp) {
+			tmp = he->next;
+			free(he);
+		}
+	}
+	free(h->tab);
+	free(h);
+}
+
+/* Add `val' under `key'.  Duplicate keys are allowed. */
+void
+htab_add(struct htab *h, const char *key, void *val)
+{
+	struct hent *he;
+	size_t b;
+
+	if (h->n >= h->sz)
+		htab_grow(h);
+	b = htab_hash(key) & (h->sz - 1);
+	he = emalloc(sizeof(*he));
+	he->key = key;
+	he->val = val;
+	he->next = h->tab[b];
+	h->tab[b] = he;
+	h->n++;
+}
+
+/* Remove the entry `key' -> `val' */
+int
+htab_del(struct htab *h, const char *key, void *val)
+{
+	struct hent **hp, *he;
+
+	hp = &h->tab[htab_hash(key) & (h->sz - 1)];
+	for (; (he = *hp); hp = &he->next) {
+		if (he->val == val && strcmp(he->key, key) == 0) {
+			*hp = he->next;
+			free(he);
+			h->n--;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+/* Return the first entry for `key' or NULL */
+struct hent *
+htab_get(struct htab *h, const char *key)
+{
+	struct hent *he;
+
+	for (he = h->tab[htab_hash(key) & (h->sz - 1)]; he; he = he->next)
+		if (strcmp(he->key, key) == 0)
+			return he;
+	return NULL;
+}
+
+/* Return the next entry with the same key as `he' or NULL */
+struct hent *
+htab_next(struct hent *he)
+{
+	struct hent *p;
+
+	for (p = he->next; p; p = p->next)
+		if (strcmp(p->key, he->key) == 0)
+			return p;
+	return NULL;
+}
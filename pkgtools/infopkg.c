@@ -2,14 +2,29 @@
 #include "pkg.h"
 
 static int own_pkg_cb(struct db *, struct pkg *, void *);
+static int own_print_cb(const char *, void *);
+static void versions(struct db *, const char *);
+static void compare(struct db *, const char *);
+static void files(struct db *, const char *);
+static void size(struct db *, const char *);
+static void largest(struct db *);
+static void below(struct db *, const char *);
 
 static void
 usage(void)
 {
 	fprintf(stderr, VERSION " (c) 2014 morpheus engineers\n");
-	fprintf(stderr, "usage: %s [-r path] [-o filename...]\n", argv0);
+	fprintf(stderr, "usage: %s [-T] [-r path] [-o filename... | -n name... | -c pkg... |\n"
+		"       -l name... | -s name... | -S | -p path...]\n", argv0);
+	fprintf(stderr, "  -T	 Print per-phase timing statistics\n");
 	fprintf(stderr, "  -r	 Set alternative installation root\n");
 	fprintf(stderr, "  -o	 Look for the packages that own the given filename(s)\n");
+	fprintf(stderr, "  -n	 List the installed versions of the given package(s)\n");
+	fprintf(stderr, "  -c	 Compare the given archive(s) with the installed version\n");
+	fprintf(stderr, "  -l	 List the files of the given package(s)\n");
+	fprintf(stderr, "  -s	 Print the installed size of the given package(s)\n");
+	fprintf(stderr, "  -S	 Print the installed size of all packages, largest first\n");
+	fprintf(stderr, "  -p	 List the packages owning files below the given path(s)\n");
 	exit(EXIT_FAILURE);
 }
 
@@ -19,12 +34,24 @@ main(int argc, char *argv[])
 	struct db *db;
 	char path[PATH_MAX];
 	char *root = "/";
-	int oflag = 0;
-	int i, r;
+	int mode = 0;
+	int i = 0, r;
 
+	prof_init();
 	ARGBEGIN {
 	case 'o':
-		oflag = 1;
+	case 'n':
+	case 'c':
+	case 'l':
+	case 's':
+	case 'S':
+	case 'p':
+		if (mode != 0)
+			usage();
+		mode = ARGC();
+		break;
+	case 'T':
+		Tflag = 1;
 		break;
 	case 'r':
 		root = ARGF();
@@ -33,9 +60,28 @@ main(int argc, char *argv[])
 		usage();
 	} ARGEND;
 
-	if (oflag == 0 || argc < 1)
+	if (mode == 0 || (mode == 'S') != (argc < 1))
 		usage();
 
+	/* ask a running pkgd first, it already has the db loaded */
+	prof_begin(PROF_QUERY);
+	for (; mode == 'o' && i < argc; i++) {
+		if (!realpath(argv[i], path)) {
+			weprintf("realpath %s:", argv[i]);
+			exit(EXIT_FAILURE);
+		}
+		r = pkgd_query(root, "owner", path, own_print_cb, path);
+		if (r == -1)
+			break;
+		if (r < 0)
+			exit(EXIT_FAILURE);
+	}
+	prof_end(PROF_QUERY);
+	if (mode == 'o' && i == argc) {
+		prof_report();
+		return EXIT_SUCCESS;
+	}
+
 	db = db_new(root);
 	if (!db)
 		exit(EXIT_FAILURE);
@@ -45,7 +91,27 @@ main(int argc, char *argv[])
 		exit(EXIT_FAILURE);
 	}
 
-	for (i = 0; i < argc; i++) {
+	prof_begin(PROF_QUERY);
+	if (mode == 'S')
+		largest(db);
+	for (; i < argc; i++) {
+		switch (mode) {
+		case 'n':
+			versions(db, argv[i]);
+			continue;
+		case 'c':
+			compare(db, argv[i]);
+			continue;
+		case 'l':
+			files(db, argv[i]);
+			continue;
+		case 's':
+			size(db, argv[i]);
+			continue;
+		case 'p':
+			below(db, argv[i]);
+			continue;
+		}
 		if (!realpath(argv[i], path)) {
 			weprintf("realpath %s:", argv[i]);
 			db_free(db);
@@ -57,8 +123,10 @@ main(int argc, char *argv[])
 			exit(EXIT_FAILURE);
 		}
 	}
+	prof_end(PROF_QUERY);
 
 	db_free(db);
+	prof_report();
 
 	return EXIT_SUCCESS;
 }
@@ -88,3 +156,187 @@ own_pkg_cb(struct db *db, struct pkg *pkg, void *file)
 	}
 	return 0;
 }
+
+static int
+own_print_cb(const char *name, void *file)
+{
+	printf("%s is owned by %s\n", (char *)file, name);
+	return 0;
+}
+
+static int
+vercmp_pkg(const void *a, const void *b)
+{
+	const struct pkg *p = *(struct pkg *const *)a;
+	const struct pkg *q = *(struct pkg *const *)b;
+
+	return vercmp(p->version ? p->version : "", q->version ? q->version : "");
+}
+
+/* Print the installed versions of `name', oldest first */
+static void
+versions(struct db *db, const char *name)
+{
+	struct hent *he;
+	struct pkg **pkgs = NULL;
+	size_t n = 0, i;
+
+	for (he = htab_get(db->names, name); he; he = htab_next(he)) {
+		pkgs = erealloc(pkgs, (n + 1) * sizeof(*pkgs));
+		pkgs[n++] = he->val;
+	}
+	if (n == 0) {
+		printf("%s is not installed\n", name);
+		return;
+	}
+	qsort(pkgs, n, sizeof(*pkgs), vercmp_pkg);
+	for (i = 0; i < n; i++)
+		printf("%s\n", strrchr(pkgs[i]->path, '/') + 1);
+	free(pkgs);
+}
+
+/* Tell whether the archive `file' is older, newer or the same as the
+ * installed versions of its package.  Only the filename is looked at,
+ * the archive is not opened. */
+static void
+compare(struct db *db, const char *file)
+{
+	struct hent *he;
+	struct pkg *pkg;
+	char *name, *version;
+	int r;
+
+	if (parse_name(file, &name) < 0)
+		return;
+	if (parse_version(file, &version) < 0) {
+		free(name);
+		return;
+	}
+	if (!(he = htab_get(db->names, name)))
+		printf("%s is not installed\n", name);
+	for (; he; he = htab_next(he)) {
+		pkg = he->val;
+		r = vercmp(version ? version : "", pkg->version ? pkg->version : "");
+		printf("%s is %s %s\n", file,
+		       r > 0 ? "newer than" : r < 0 ? "older than" : "the same as",
+		       strrchr(pkg->path, '/') + 1);
+	}
+	free(name);
+	free(version);
+}
+
+/* Print `path' the way the user sees it, without the doubled slash
+ * of entries below "/" */
+static const char *
+display(struct db *db, const char *path)
+{
+	return strcmp(db->root, "/") == 0 ? path + 1 : path;
+}
+
+/* Print the files of every installed version of `name' */
+static void
+files(struct db *db, const char *name)
+{
+	struct hent *he;
+	struct pkgentry *pe;
+
+	if (!(he = htab_get(db->names, name)))
+		weprintf("%s is not installed\n", name);
+	for (; he; he = htab_next(he))
+		TAILQ_FOREACH(pe, &((struct pkg *)he->val)->pe_head, entry)
+			printf("%s\n", display(db, pe->path));
+}
+
+/* Size of `pkg' as recorded at install time.  Packages installed
+ * before sizes were recorded fall back to summing their files. */
+static off_t
+pkgsize(struct pkg *pkg)
+{
+	struct pkgentry *pe;
+	struct stat sb;
+
+	if (pkg->size >= 0)
+		return pkg->size;
+	pkg->size = 0;
+	TAILQ_FOREACH(pe, &pkg->pe_head, entry)
+		if (lstat(pe->path, &sb) == 0 && S_ISREG(sb.st_mode))
+			pkg->size += sb.st_size;
+	return pkg->size;
+}
+
+/* Print the installed size in bytes of every version of `name' */
+static void
+size(struct db *db, const char *name)
+{
+	struct hent *he;
+	struct pkg *pkg;
+
+	if (!(he = htab_get(db->names, name)))
+		weprintf("%s is not installed\n", name);
+	for (; he; he = htab_next(he)) {
+		pkg = he->val;
+		printf("%lld\t%s\n", (long long)pkgsize(pkg),
+		       strrchr(pkg->path, '/') + 1);
+	}
+}
+
+static int
+sizecmp(const void *a, const void *b)
+{
+	struct pkg *p = *(struct pkg *const *)a;
+	struct pkg *q = *(struct pkg *const *)b;
+
+	if (pkgsize(p) != pkgsize(q))
+		return pkgsize(p) < pkgsize(q) ? 1 : -1;
+	return strcmp(p->name, q->name);
+}
+
+/* Print the size of all installed packages, largest first */
+static void
+largest(struct db *db)
+{
+	struct pkg *pkg, **pkgs;
+	size_t n = 0, i;
+
+	TAILQ_FOREACH(pkg, &db->pkg_head, entry)
+		n++;
+	pkgs = ecalloc(n ? n : 1, sizeof(*pkgs));
+	i = 0;
+	TAILQ_FOREACH(pkg, &db->pkg_head, entry)
+		pkgs[i++] = pkg;
+	qsort(pkgs, n, sizeof(*pkgs), sizecmp);
+	for (i = 0; i < n; i++)
+		printf("%lld\t%s\n", (long long)pkgsize(pkgs[i]),
+		       strrchr(pkgs[i]->path, '/') + 1);
+	free(pkgs);
+}
+
+/* Print the packages owning `dir' or anything below it */
+static void
+below(struct db *db, const char *dir)
+{
+	struct pkg *pkg;
+	struct pkgentry *pe;
+	char path[PATH_MAX], key[PATH_MAX];
+	size_t len;
+
+	if (!realpath(dir, path)) {
+		weprintf("realpath %s:", dir);
+		return;
+	}
+	if (db_path_key(db, path, key, sizeof(key)) < 0) {
+		weprintf("%s: not below %s\n", dir, db->root);
+		return;
+	}
+	len = strlen(key);
+	TAILQ_FOREACH(pkg, &db->pkg_head, entry) {
+		TAILQ_FOREACH(pe, &pkg->pe_head, entry) {
+			if (strncmp(pe->path, key, len) == 0 &&
+			    (pe->path[len] == '/' || pe->path[len] == '\0' ||
+			     key[len - 1] == '/')) {
+				printf("%s\n", strrchr(pkg->path, '/') + 1);
+				break;
+			}
+		}
+	}
+}
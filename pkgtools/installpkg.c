@@ -1,26 +1,46 @@
 /* See LICENSE file for copyright and license details. */
 #include "pkg.h"
 
+static int dryrun(struct pkg_head *, int, int);
+static int installed(const char *);
+static struct pkg *next(struct pkg_head *, struct pkg *);
+static int collisions(struct pkg *);
+static int clashes(struct pkg_head *, int);
+static int install(struct pkg *, int);
+
+static struct db **dbs;			/* one db per installation root */
+static int ndbs;
+
 static void
 usage(void)
 {
 	fprintf(stderr, VERSION " (c) 2014 morpheus engineers\n");
-	fprintf(stderr, "usage: %s [-v] [-f] [-r path] pkg...\n", argv0);
+	fprintf(stderr, "usage: %s [-v] [-f] [-c] [-p] [-n] [-T] [-j jobs] [-r path] pkg...\n", argv0);
 	fprintf(stderr, "  -v    Enable verbose output\n");
-	fprintf(stderr, "  -f    Override filesystem checks and force installation\n");
-	fprintf(stderr, "  -r    Set alternative installation root\n");
+	fprintf(stderr, "  -f    Override filesystem and dependency checks and force installation\n");
+	fprintf(stderr, "  -c    Write compact, front coded db records\n");
+	fprintf(stderr, "  -p    Print the install plan and exit\n");
+	fprintf(stderr, "  -n    Check and report what would be installed, write nothing\n");
+	fprintf(stderr, "  -T    Print per-phase timing statistics\n");
+	fprintf(stderr, "  -j    Install up to jobs independent packages concurrently\n");
+	fprintf(stderr, "  -r    Set alternative installation root, may be repeated\n");
 	exit(EXIT_FAILURE);
 }
 
 int
 main(int argc, char *argv[])
 {
-	struct db *db;
-	struct pkg *pkg;
+	struct pkg_head head;
+	struct pkg *pkg, *tmp;
 	char path[PATH_MAX];
-	char *root = "/";
-	int i;
+	char **roots, *arg;
+	int pflag = 0, nflag = 0, jobs = 1;
+	int i, lvl, maxlvl, running, status, space, serial;
+	int r = EXIT_FAILURE;
+	pid_t pid;
 
+	prof_init();
+	roots = ecalloc(argc + 1, sizeof(*roots));
 	ARGBEGIN {
 	case 'v':
 		vflag = 1;
@@ -28,8 +48,29 @@ main(int argc, char *argv[])
 	case 'f':
 		fflag = 1;
 		break;
+	case 'c':
+		cflag = 1;
+		break;
+	case 'p':
+		pflag = 1;
+		break;
+	case 'n':
+		nflag = 1;
+		break;
+	case 'T':
+		Tflag = 1;
+		break;
+	case 'j':
+		arg = ARGF();
+		if (!arg)
+			usage();
+		jobs = atoi(arg);
+		if (jobs < 1)
+			usage();
+		break;
 	case 'r':
-		root = ARGF();
+		if (!(roots[ndbs++] = ARGF()))
+			usage();
 		break;
 	default:
 		usage();
@@ -38,45 +79,295 @@ main(int argc, char *argv[])
 	if (argc < 1)
 		usage();
 
-	db = db_new(root);
-	if (!db)
-		exit(EXIT_FAILURE);
-	if (db_load(db) < 0) {
-		db_free(db);
-		exit(EXIT_FAILURE);
+	if (ndbs == 0)
+		roots[ndbs++] = "/";
+	dbs = ecalloc(ndbs, sizeof(*dbs));
+	for (i = 0; i < ndbs; i++) {
+		dbs[i] = db_new(roots[i]);
+		if (!dbs[i] || db_load(dbs[i]) < 0) {
+			for (; i >= 0; i--)
+				if (dbs[i])
+					db_free(dbs[i]);
+			exit(EXIT_FAILURE);
+		}
 	}
+	db_sigignore();
 
+	TAILQ_INIT(&head);
 	for (i = 0; i < argc; i++) {
 		if (!realpath(argv[i], path)) {
 			weprintf("realpath %s:", argv[i]);
-			db_free(db);
-			exit(EXIT_FAILURE);
+			goto out;
 		}
-		if (vflag == 1)
-			printf("installing %s\n", path);
-		pkg = pkg_load_file(db, path);
-		if (!pkg) {
-			db_free(db);
-			exit(EXIT_FAILURE);
+		/* a reinstall of the same version is a no-op, find out
+		 * without decompressing the archive */
+		if (fflag == 0 && installed(path)) {
+			printf("%s is already installed\n", path);
+			continue;
+		}
+		pkg = pkg_load_file(dbs[0], path);
+		if (!pkg)
+			goto out;
+		TAILQ_INSERT_TAIL(&head, pkg, entry);
+	}
+
+	/* a dependency missing from any of the roots is installed */
+	for (i = 0; i < ndbs; i++)
+		if (plan_resolve(dbs[i], &head) < 0 && fflag == 0)
+			goto out;
+	maxlvl = plan_levels(&head);
+	if (maxlvl < 0)
+		goto out;
+
+	if (pflag == 1) {
+		for (lvl = 0; lvl <= maxlvl; lvl++)
+			TAILQ_FOREACH(pkg, &head, entry)
+				if (pkg->level == lvl)
+					printf("%d %s\n", lvl, pkg->path);
+		r = EXIT_SUCCESS;
+		goto out;
+	}
+
+	/* fail before writing anything rather than halfway through */
+	space = space_check(dbs, ndbs, &head);
+	if (nflag == 1) {
+		if (dryrun(&head, maxlvl, space) == 0)
+			r = EXIT_SUCCESS;
+		goto out;
+	}
+	if (space < 0 && fflag == 0)
+		goto out;
+
+	for (lvl = 0; lvl <= maxlvl; lvl++) {
+		/* children cannot see each other's files, packages of a
+		 * level sharing one are refused, or installed one by one
+		 * when forced */
+		serial = jobs == 1;
+		if (serial == 0 && clashes(&head, lvl) < 0) {
+			if (fflag == 0)
+				goto out;
+			serial = 1;
 		}
+		if (serial == 1) {
+			TAILQ_FOREACH(pkg, &head, entry) {
+				if (pkg->level != lvl)
+					continue;
+				/* warm up the next archive while this one extracts */
+				if ((tmp = next(&head, pkg)))
+					pkg_prefetch(tmp);
+				if (install(pkg, 1) < 0)
+					goto out;
+			}
+			continue;
+		}
+
+		/* check the whole level before any of them starts
+		 * extracting */
 		if (fflag == 0) {
-			if (pkg_collisions(pkg) < 0) {
-				printf("not installed %s\n", path);
-				db_free(db);
-				exit(EXIT_FAILURE);
+			TAILQ_FOREACH(pkg, &head, entry) {
+				if (pkg->level != lvl)
+					continue;
+				if (collisions(pkg) < 0)
+					goto out;
 			}
 		}
-		if (db_add(db, pkg) < 0) {
-			db_free(db);
-			exit(EXIT_FAILURE);
+
+		running = 0;
+		status = 0;
+		TAILQ_FOREACH(pkg, &head, entry) {
+			if (pkg->level != lvl)
+				continue;
+			if (running == jobs) {
+				if (wait(&i) > 0 && (!WIFEXITED(i) || WEXITSTATUS(i) != 0))
+					status = -1;
+				running--;
+			}
+			if ((tmp = next(&head, pkg)))
+				pkg_prefetch(tmp);
+			fflush(stdout);
+			switch ((pid = fork())) {
+			case -1:
+				weprintf("fork:");
+				status = -1;
+				break;
+			case 0:
+				prof_reset();
+				i = install(pkg, 0);
+				prof_report();
+				fflush(stdout);
+				_exit(i < 0 ? EXIT_FAILURE : EXIT_SUCCESS);
+			default:
+				running++;
+				break;
+			}
+			if (status < 0)
+				break;
 		}
-		if (pkg_install(db, pkg) < 0) {
-			db_free(db);
-			exit(EXIT_FAILURE);
+		for (; running > 0; running--)
+			if (wait(&i) > 0 && (!WIFEXITED(i) || WEXITSTATUS(i) != 0))
+				status = -1;
+		if (status < 0)
+			goto out;
+	}
+	r = EXIT_SUCCESS;
+
+out:
+	for (pkg = TAILQ_FIRST(&head); pkg; pkg = tmp) {
+		tmp = TAILQ_NEXT(pkg, entry);
+		TAILQ_REMOVE(&head, pkg, entry);
+		pkg_free(pkg);
+	}
+	for (i = 0; i < ndbs; i++)
+		db_free(dbs[i]);
+	free(dbs);
+	free(roots);
+	prof_report();
+	return r;
+}
+
+/* Report what installing the plan would write, in install order,
+ * after running the same checks as a real install */
+static int
+dryrun(struct pkg_head *head, int maxlvl, int space)
+{
+	struct pkg *pkg;
+	struct pkgentry *pe;
+	unsigned long long files, bytes, rejected;
+	unsigned long long tfiles = 0, tbytes = 0, npkgs = 0;
+	int i, lvl, r = space;
+
+	for (lvl = 0; lvl <= maxlvl; lvl++) {
+		TAILQ_FOREACH(pkg, head, entry) {
+			if (pkg->level != lvl)
+				continue;
+			if (fflag == 0 && collisions(pkg) < 0)
+				r = -1;
+			files = bytes = rejected = 0;
+			for (i = 0; i < ndbs; i++) {
+				TAILQ_FOREACH(pe, &pkg->pe_head, entry) {
+					if (rej_match(dbs[i], pe->rpath) > 0) {
+						rejected++;
+						continue;
+					}
+					files++;
+					bytes += pe->size;
+				}
+			}
+			printf("install %s: %llu files, %llu bytes, %llu rejected\n",
+			       pkg->path, files, bytes, rejected);
+			tfiles += files;
+			tbytes += bytes;
+			npkgs++;
 		}
-		printf("installed %s\n", path);
 	}
+	printf("total: %llu packages, %llu files, %llu bytes, roughly %.1fs (guess)\n",
+	       npkgs, tfiles, tbytes, prof_estimate(PROF_EXTRACT, tbytes, tfiles));
+	return r;
+}
+
+/* Whether the version of the archive `path' is installed in all roots */
+static int
+installed(const char *path)
+{
+	char *name, *version;
+	int i, r = 0;
+
+	if (parse_name(path, &name) < 0)
+		return 0;
+	if (parse_version(path, &version) < 0) {
+		free(name);
+		return 0;
+	}
+	if (version) {
+		for (i = 0; i < ndbs; i++)
+			if (!db_find(dbs[i], name, version))
+				break;
+		r = i == ndbs;
+	}
+	free(name);
+	free(version);
+	return r;
+}
+
+/* Return the package which is installed after `pkg' */
+static struct pkg *
+next(struct pkg_head *head, struct pkg *pkg)
+{
+	struct pkg *p;
+
+	for (p = TAILQ_NEXT(pkg, entry); p; p = TAILQ_NEXT(p, entry))
+		if (p->level == pkg->level)
+			return p;
+	TAILQ_FOREACH(p, head, entry)
+		if (p->level == pkg->level + 1)
+			return p;
+	return NULL;
+}
+
+static int
+collisions(struct pkg *pkg)
+{
+	int i;
+
+	for (i = 0; i < ndbs; i++) {
+		if (pkg_collisions(dbs[i], pkg) < 0) {
+			printf("not installed %s\n", pkg->path);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/* Report the files which more than one package of level `lvl' ship */
+static int
+clashes(struct pkg_head *head, int lvl)
+{
+	struct htab *paths;
+	struct hent *he;
+	struct pkg *pkg;
+	struct pkgentry *pe;
+	size_t len;
+	int r = 0;
+
+	paths = htab_new(1024);
+	TAILQ_FOREACH(pkg, head, entry) {
+		if (pkg->level != lvl)
+			continue;
+		TAILQ_FOREACH(pe, &pkg->pe_head, entry) {
+			/* directories are shared */
+			len = strlen(pe->rpath);
+			if (len == 0 || pe->rpath[len - 1] == '/')
+				continue;
+			if ((he = htab_get(paths, pe->rpath))) {
+				if (he->val != pkg) {
+					weprintf("%s is in %s and %s\n", pe->rpath,
+						 ((struct pkg *)he->val)->path, pkg->path);
+					r = -1;
+				}
+				continue;
+			}
+			htab_add(paths, pe->rpath, pkg);
+		}
+	}
+	htab_free(paths);
+	return r;
+}
+
+static int
+install(struct pkg *pkg, int check)
+{
+	int i;
 
-	db_free(db);
-	return EXIT_SUCCESS;
+	if (vflag == 1)
+		printf("installing %s\n", pkg->path);
+	if (check == 1 && fflag == 0 && collisions(pkg) < 0)
+		return -1;
+	/* a package which failed to extract is not recorded */
+	if (pkg_install(dbs, ndbs, pkg) < 0)
+		return -1;
+	for (i = 0; i < ndbs; i++)
+		if (db_add(dbs[i], pkg) < 0)
+			return -1;
+	printf("installed %s\n", pkg->path);
+	return 0;
 }
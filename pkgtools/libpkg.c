@@ -0,0 +1,126 @@
+/* See LICENSE file for copyright and license details. */
+#include "pkg.h"
+#include "libpkg.h"
+
+struct pkgdb {
+	struct db *db;
+	struct htab *owners;		/* pkgentry path -> pkg, built on demand */
+};
+
+/* Open and load the db below `root' */
+int
+pkgdb_open(struct pkgdb **pdbp, const char *root)
+{
+	struct pkgdb *pdb;
+
+	pdb = emalloc(sizeof(*pdb));
+	pdb->owners = NULL;
+	if (!(pdb->db = db_new(root))) {
+		free(pdb);
+		return -1;
+	}
+	if (db_load(pdb->db) < 0) {
+		db_free(pdb->db);
+		free(pdb);
+		return -1;
+	}
+	*pdbp = pdb;
+	return 0;
+}
+
+void
+pkgdb_close(struct pkgdb *pdb)
+{
+	if (pdb->owners)
+		htab_free(pdb->owners);
+	db_free(pdb->db);
+	free(pdb);
+}
+
+struct pkg *
+pkgdb_pkg_first(struct pkgdb *pdb)
+{
+	return TAILQ_FIRST(&pdb->db->pkg_head);
+}
+
+struct pkg *
+pkgdb_pkg_next(struct pkg *pkg)
+{
+	return TAILQ_NEXT(pkg, entry);
+}
+
+/* Return the installed package called `name' */
+struct pkg *
+pkgdb_pkg_find(struct pkgdb *pdb, const char *name)
+{
+	return db_find(pdb->db, name, NULL);
+}
+
+const char *
+pkgdb_pkg_name(const struct pkg *pkg)
+{
+	return pkg->name;
+}
+
+const char *
+pkgdb_pkg_version(const struct pkg *pkg)
+{
+	return pkg->version;
+}
+
+struct pkgentry *
+pkgdb_file_first(struct pkg *pkg)
+{
+	return TAILQ_FIRST(&pkg->pe_head);
+}
+
+struct pkgentry *
+pkgdb_file_next(struct pkgentry *pe)
+{
+	return TAILQ_NEXT(pe, entry);
+}
+
+const char *
+pkgdb_file_path(const struct pkgentry *pe)
+{
+	return pe->path;
+}
+
+const char *
+pkgdb_file_rpath(const struct pkgentry *pe)
+{
+	return pe->rpath;
+}
+
+/* Return the next package after `prev' owning `path', which must
+ * be the absolute path of the entry, without symlinks resolved */
+struct pkg *
+pkgdb_owner(struct pkgdb *pdb, const char *path, struct pkg *prev)
+{
+	struct pkg *pkg;
+	struct pkgentry *pe;
+	struct hent *he;
+	char key[PATH_MAX];
+
+	if (!pdb->owners) {
+		pdb->owners = htab_new(1024);
+		TAILQ_FOREACH(pkg, &pdb->db->pkg_head, entry)
+			TAILQ_FOREACH(pe, &pkg->pe_head, entry)
+				htab_add(pdb->owners, pe->path, pkg);
+	}
+
+	if (db_path_key(pdb->db, path, key, sizeof(key)) < 0)
+		return NULL;
+	he = htab_get(pdb->owners, key);
+	/* directory entries keep their trailing slash */
+	if (!he && strlcat(key, "/", sizeof(key)) < sizeof(key))
+		he = htab_get(pdb->owners, key);
+
+	if (prev) {
+		for (; he && he->val != prev; he = htab_next(he))
+			;
+		if (he)
+			he = htab_next(he);
+	}
+	return he ? he->val : NULL;
+}
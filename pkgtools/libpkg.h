@@ -0,0 +1,37 @@
+/* See LICENSE file for copyright and license details. */
+#ifndef LIBPKG_H__
+#define LIBPKG_H__
+
+/*
+ * Read-only access to the pkgtools package db.
+ *
+ * All handles are opaque.  Functions returning int return 0 on
+ * success and -1 on failure, functions returning a pointer return
+ * NULL at the end of an iteration or on failure.  Nothing in here
+ * terminates the calling process on a malformed db.
+ */
+
+struct pkgdb;
+struct pkg;
+struct pkgentry;
+
+int pkgdb_open(struct pkgdb **, const char *);
+void pkgdb_close(struct pkgdb *);
+
+/* packages */
+struct pkg *pkgdb_pkg_first(struct pkgdb *);
+struct pkg *pkgdb_pkg_next(struct pkg *);
+struct pkg *pkgdb_pkg_find(struct pkgdb *, const char *);
+const char *pkgdb_pkg_name(const struct pkg *);
+const char *pkgdb_pkg_version(const struct pkg *);
+
+/* files of a package */
+struct pkgentry *pkgdb_file_first(struct pkg *);
+struct pkgentry *pkgdb_file_next(struct pkgentry *);
+const char *pkgdb_file_path(const struct pkgentry *);
+const char *pkgdb_file_rpath(const struct pkgentry *);
+
+/* packages owning an absolute path, pass NULL to get the first one */
+struct pkg *pkgdb_owner(struct pkgdb *, const char *, struct pkg *);
+
+#endif
@@ -1,6 +1,99 @@
 /* See LICENSE file for copyright and license details. */
+#include <fcntl.h>
 #include "pkg.h"
 
+/* Strip the leading "./" from an archive entry path */
+static const char *
+pkg_entry_path(const char *path)
+{
+	if (strncmp(path, "./", 2) == 0)
+		path += 2;
+	return path;
+}
+
+/* Parse the whitespace separated dependency list stored in PKGDEPS */
+static int
+pkg_load_deps(struct pkg *pkg, struct archive *ar)
+{
+	struct pkgdep *pd;
+	char *buf = NULL, *p;
+	size_t len = 0;
+	ssize_t r;
+
+	do {
+		buf = erealloc(buf, len + BUFSIZ + 1);
+		r = archive_read_data(ar, buf + len, BUFSIZ);
+		if (r < 0) {
+			weprintf("archive_read_data %s: %s\n", PKGDEPS,
+				 archive_error_string(ar));
+			free(buf);
+			return -1;
+		}
+		len += r;
+	} while (r > 0);
+	buf[len] = '\0';
+
+	for (p = strtok(buf, " \t\n"); p; p = strtok(NULL, " \t\n")) {
+		pd = pkgdep_new(p);
+		TAILQ_INSERT_TAIL(&pkg->pd_head, pd, entry);
+	}
+	free(buf);
+
+	return 0;
+}
+
+/* Open the package archive `path' for reading, the descriptor is
+ * returned in `fd' */
+static struct archive *
+pkg_archive_open(const char *path, int *fd)
+{
+	struct archive *ar;
+
+	if ((*fd = open(path, O_RDONLY | O_CLOEXEC)) < 0) {
+		weprintf("open %s:", path);
+		return NULL;
+	}
+	/* archives are read front to back exactly once, let the
+	 * kernel read ahead aggressively */
+	posix_fadvise(*fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+	ar = archive_read_new();
+
+	archive_read_support_filter_gzip(ar);
+	archive_read_support_filter_bzip2(ar);
+	archive_read_support_filter_xz(ar);
+	archive_read_support_format_tar(ar);
+
+	if (archive_read_open_fd(ar, *fd, ARCHIVEBUFSIZ) < 0) {
+		weprintf("archive_read_open_fd %s: %s\n", path,
+			 archive_error_string(ar));
+		archive_read_free(ar);
+		close(*fd);
+		return NULL;
+	}
+	return ar;
+}
+
+static void
+pkg_archive_close(struct archive *ar, int fd)
+{
+	archive_read_free(ar);
+	close(fd);
+}
+
+/* Start reading the archive of `pkg' into the page cache in the
+ * background, so it is warm by the time it is extracted */
+void
+pkg_prefetch(struct pkg *pkg)
+{
+	int fd;
+
+	if ((fd = open(pkg->path, O_RDONLY | O_CLOEXEC)) < 0)
+		return;
+	posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+	close(fd);
+}
+
 /* Create a package from the db entry.  e.g. /var/pkg/pkg#version */
 struct pkg *
 pkg_load(struct db *db, const char *file)
@@ -11,17 +104,18 @@ pkg_load(struct db *db, const char *file)
 	char path[PATH_MAX];
 	char *name, *version;
 	char *buf = NULL;
-	size_t sz = 0;
+	size_t sz, n;
 	ssize_t len;
+	int compact;
 
 	parse_db_name(file, &name);
 	parse_db_version(file, &version);
-	estrlcpy(path, db->path, sizeof(path));
-	estrlcat(path, "/", sizeof(path));
-	estrlcat(path, name, sizeof(path));
-	if (version) {
-		estrlcat(path, "#", sizeof(path));
-		estrlcat(path, version, sizeof(path));
+	if (snprintf(path, sizeof(path), "%s/%s%s%s", db->path, name,
+		     version ? "#" : "", version ? version : "") >= (int)sizeof(path)) {
+		weprintf("%s: path too long\n", file);
+		free(name);
+		free(version);
+		return NULL;
 	}
 	pkg = pkg_new(path, name, version);
 	free(name);
@@ -33,7 +127,28 @@ pkg_load(struct db *db, const char *file)
 		return NULL;
 	}
 
-	while ((len = getline(&buf, &sz, fp)) != -1) {
+	/* compact records are read in one go, text ones line by line */
+	sz = BUFSIZ;
+	buf = emalloc(sz);
+	n = fread(buf, 1, sizeof(COMPACTMAGIC) - 1, fp);
+	compact = compact_magic(buf, n);
+	if (compact) {
+		while (!feof(fp) && !ferror(fp)) {
+			if (n == sz)
+				buf = erealloc(buf, sz *= 2);
+			n += fread(buf + n, 1, sz - n, fp);
+		}
+		if (!ferror(fp) && compact_read(db, pkg, buf, n) < 0) {
+			free(buf);
+			fclose(fp);
+			pkg_free(pkg);
+			return NULL;
+		}
+	} else {
+		rewind(fp);
+	}
+
+	while (!compact && (len = getline(&buf, &sz, fp)) != -1) {
 		if (len > 0 && buf[len - 1] == '\n')
 			buf[len - 1] = '\0';
 
@@ -46,6 +161,12 @@ pkg_load(struct db *db, const char *file)
 		}
 
 		pe = pkgentry_new(db, buf);
+		if (!pe) {
+			free(buf);
+			fclose(fp);
+			pkg_free(pkg);
+			return NULL;
+		}
 		TAILQ_INSERT_TAIL(&pkg->pe_head, pe, entry);
 	}
 
@@ -60,6 +181,11 @@ pkg_load(struct db *db, const char *file)
 	free(buf);
 	fclose(fp);
 
+	if (db_meta_load(db, pkg) < 0) {
+		pkg_free(pkg);
+		return NULL;
+	}
+
 	return pkg;
 }
 
@@ -74,31 +200,32 @@ pkg_load_file(struct db *db, const char *file)
 	char path[PATH_MAX];
 	const char *tmp;
 	char *name, *version;
-	int r;
+	int fd, r;
 
+	prof_begin(PROF_LOAD_FILE);
 	if (!realpath(file, path)) {
 		weprintf("realpath %s:", file);
+		prof_end(PROF_LOAD_FILE);
 		return NULL;
 	}
 
-	parse_name(path, &name);
-	parse_version(path, &version);
+	if (parse_name(path, &name) < 0) {
+		prof_end(PROF_LOAD_FILE);
+		return NULL;
+	}
+	if (parse_version(path, &version) < 0) {
+		free(name);
+		prof_end(PROF_LOAD_FILE);
+		return NULL;
+	}
 	pkg = pkg_new(path, name, version);
+	pkg->size = 0;
 	free(name);
 	free(version);
 
-	ar = archive_read_new();
-
-	archive_read_support_filter_gzip(ar);
-	archive_read_support_filter_bzip2(ar);
-	archive_read_support_filter_xz(ar);
-	archive_read_support_format_tar(ar);
-
-	if (archive_read_open_filename(ar, pkg->path, ARCHIVEBUFSIZ) < 0) {
-		weprintf("archive_read_open_filename %s: %s\n", pkg->path,
-			 archive_error_string(ar));
-		archive_read_free(ar);
+	if (!(ar = pkg_archive_open(pkg->path, &fd))) {
 		pkg_free(pkg);
+		prof_end(PROF_LOAD_FILE);
 		return NULL;
 	}
 
@@ -109,60 +236,225 @@ pkg_load_file(struct db *db, const char *file)
 		if (r != ARCHIVE_OK) {
 			weprintf("archive_read_next_header: %s\n",
 				 archive_error_string(ar));
-			archive_read_free(ar);
+			pkg_archive_close(ar, fd);
 			pkg_free(pkg);
+			prof_end(PROF_LOAD_FILE);
 			return NULL;
 		}
 
-		tmp = archive_entry_pathname(entry);
-		if (strncmp(tmp, "./", 2) == 0)
-			tmp += 2;
+		tmp = pkg_entry_path(archive_entry_pathname(entry));
 
 		if (tmp[0] == '\0')
 			continue;
 
+		if (strcmp(tmp, PKGDEPS) == 0) {
+			if (pkg_load_deps(pkg, ar) < 0) {
+				pkg_archive_close(ar, fd);
+				pkg_free(pkg);
+				prof_end(PROF_LOAD_FILE);
+				return NULL;
+			}
+			continue;
+		}
+
 		pe = pkgentry_new(db, tmp);
+		if (!pe) {
+			pkg_archive_close(ar, fd);
+			pkg_free(pkg);
+			prof_end(PROF_LOAD_FILE);
+			return NULL;
+		}
+		if (archive_entry_filetype(entry) == AE_IFREG &&
+		    !archive_entry_hardlink(entry))
+			pe->size = archive_entry_size(entry);
+		pkg->size += pe->size;
 		TAILQ_INSERT_TAIL(&pkg->pe_head, pe, entry);
 	}
 
-	archive_read_free(ar);
+	pkg_archive_close(ar, fd);
 
+	prof_end(PROF_LOAD_FILE);
 	return pkg;
 }
 
-int
-pkg_install(struct db *db, struct pkg *pkg)
+/* Copy the data of the current entry of `ar' to every writer in
+ * `w' which accepted its header.  The archive is read only once. */
+static int
+pkg_copy_data(struct archive *ar, struct archive **w, int *skip, int n)
 {
-	struct archive *ar;
-	struct archive_entry *entry;
-	char cwd[PATH_MAX];
-	int flags, r;
+	const void *buf;
+	size_t size;
+	int64_t offset;
+	int i, r;
+
+	while ((r = archive_read_data_block(ar, &buf, &size, &offset)) == ARCHIVE_OK) {
+		for (i = 0; i < n; i++) {
+			if (skip[i])
+				continue;
+			if (archive_write_data_block(w[i], buf, size, offset) < 0) {
+				weprintf("archive_write_data_block: %s\n",
+					 archive_error_string(w[i]));
+				return -1;
+			}
+		}
+	}
+	if (r != ARCHIVE_EOF) {
+		weprintf("archive_read_data_block: %s\n", archive_error_string(ar));
+		return -1;
+	}
+	return 0;
+}
 
-	ar = archive_read_new();
+/* Paths written by pkg_install(), removed again if it fails */
+struct undo {
+	char **paths;
+	size_t n;
+};
 
-	archive_read_support_filter_gzip(ar);
-	archive_read_support_filter_bzip2(ar);
-	archive_read_support_filter_xz(ar);
-	archive_read_support_format_tar(ar);
+static void
+undo_add(struct undo *u, const char *path)
+{
+	u->paths = erealloc(u->paths, (u->n + 1) * sizeof(*u->paths));
+	u->paths[u->n++] = estrdup(path);
+}
 
-	if (archive_read_open_filename(ar, pkg->path, ARCHIVEBUFSIZ) < 0) {
-		weprintf("archive_read_open_filename %s: %s\n", pkg->path,
-			 archive_error_string(ar));
-		archive_read_free(ar);
+/* Remove the written paths, newest first.  Directories are only
+ * removed if they were created and are empty. */
+static void
+undo_run(struct undo *u, int rollback)
+{
+	while (u->n > 0) {
+		u->n--;
+		if (rollback) {
+			if (vflag == 1)
+				printf("removing %s\n", u->paths[u->n]);
+			if (remove(u->paths[u->n]) < 0 && errno != ENOENT &&
+			    errno != ENOTEMPTY && errno != EEXIST)
+				weprintf("remove %s:", u->paths[u->n]);
+		}
+		free(u->paths[u->n]);
+	}
+	free(u->paths);
+	u->paths = NULL;
+}
+
+/* Write the regular file `entry' to `path' through `w', taking its
+ * data from the store object `obj' */
+static int
+pkg_write_file(struct archive *w, struct archive_entry *entry,
+	       const char *path, const char *obj)
+{
+	struct archive_entry *e;
+	char buf[ARCHIVEBUFSIZ];
+	ssize_t len;
+	int fd, r;
+
+	e = archive_entry_clone(entry);
+	archive_entry_copy_pathname(e, path);
+	r = archive_write_header(w, e);
+	archive_entry_free(e);
+	if (r != ARCHIVE_OK && r != ARCHIVE_WARN) {
+		weprintf("archive_write_header %s: %s\n", path,
+			 archive_error_string(w));
+		return -1;
+	}
+	if ((fd = open(obj, O_RDONLY)) < 0) {
+		weprintf("open %s:", obj);
+		return -1;
+	}
+	while ((len = read(fd, buf, sizeof(buf))) > 0) {
+		if (archive_write_data(w, buf, len) < 0) {
+			weprintf("archive_write_data %s: %s\n", path,
+				 archive_error_string(w));
+			close(fd);
+			return -1;
+		}
+	}
+	if (len < 0) {
+		weprintf("read %s:", obj);
+		close(fd);
+		return -1;
+	}
+	close(fd);
+	r = archive_write_finish_entry(w);
+	if (r != ARCHIVE_OK && r != ARCHIVE_WARN) {
+		weprintf("archive_write_finish_entry %s: %s\n", path,
+			 archive_error_string(w));
 		return -1;
 	}
+	return 0;
+}
 
-	if (!getcwd(cwd, sizeof(cwd))) {
-		weprintf("getcwd:");
-		archive_read_free(ar);
+/* Extract the regular file `entry' into the store of dbs[st] and
+ * hardlink it into every root.  Roots without a store, or whose
+ * store is on another filesystem, get a copy of the object. */
+static int
+pkg_store_entry(struct db **dbs, int n, int *store, int st, struct archive *ar,
+		struct archive_entry *entry, const char *name, struct archive **w,
+		struct undo *u)
+{
+	char key[STOREKEYLEN], obj[PATH_MAX], path[PATH_MAX];
+	int i;
+
+	if (store_spool(dbs[st], ar, entry, key) < 0)
 		return -1;
+	store_path(dbs[st], key, obj, sizeof(obj));
+	for (i = 0; i < n; i++) {
+		if (rej_match(dbs[i], archive_entry_pathname(entry)) > 0) {
+			weprintf("rejecting %s\n", archive_entry_pathname(entry));
+			continue;
+		}
+		db_entry_path(dbs[i], name, path, sizeof(path));
+		prof_count(PROF_FILES, 1);
+		prof_count(PROF_BYTES_OUT, archive_entry_size(entry));
+		undo_add(u, path);
+		if (store[i] && (i == st || store_import(dbs[i], key, obj) == 0) &&
+		    store_link(dbs[i], key, path) == 0)
+			continue;
+		if (pkg_write_file(w[i], entry, path, obj) < 0)
+			return -1;
 	}
-	if (chdir(db->root) < 0) {
-		weprintf("chdir %s:", db->root);
-		archive_read_free(ar);
+	return 0;
+}
+
+/* Extract `pkg' into the roots of all `n' dbs with a single pass
+ * over the archive, so it is decompressed only once.  Any error is
+ * fatal and removes what was written so far, so that a package is
+ * either fully installed or not at all. */
+int
+pkg_install(struct db **dbs, int n, struct pkg *pkg)
+{
+	struct archive *ar, **w;
+	struct archive_entry *entry, *e;
+	struct undo u = { NULL, 0 };
+	struct stat sb;
+	char path[PATH_MAX];
+	const char *name, *link;
+	int *skip, *store;
+	int fd, flags, i, r, st = -1, ret = 0;
+
+	prof_begin(PROF_EXTRACT);
+	if (!(ar = pkg_archive_open(pkg->path, &fd))) {
+		prof_end(PROF_EXTRACT);
 		return -1;
 	}
 
+	flags = ARCHIVE_EXTRACT_OWNER | ARCHIVE_EXTRACT_PERM |
+		ARCHIVE_EXTRACT_TIME | ARCHIVE_EXTRACT_SECURE_NODOTDOT;
+	if (fflag == 1)
+		flags |= ARCHIVE_EXTRACT_UNLINK;
+	w = ecalloc(n, sizeof(*w));
+	skip = ecalloc(n, sizeof(*skip));
+	store = ecalloc(n, sizeof(*store));
+	for (i = 0; i < n; i++) {
+		w[i] = archive_write_disk_new();
+		archive_write_disk_set_options(w[i], flags);
+		archive_write_disk_set_standard_lookup(w[i]);
+		store[i] = store_enabled(dbs[i]);
+		if (store[i] && st < 0)
+			st = i;
+	}
+
 	while (1) {
 		r = archive_read_next_header(ar, &entry);
 		if (r == ARCHIVE_EOF)
@@ -170,33 +462,89 @@ pkg_install(struct db *db, struct pkg *pkg)
 		if (r != ARCHIVE_OK) {
 			weprintf("archive_read_next_header %s: %s\n",
 				 archive_entry_pathname(entry), archive_error_string(ar));
-			if (chdir(cwd) < 0)
-				weprintf("chdir %s:", cwd);
-			archive_read_free(ar);
-			return -1;
+			ret = -1;
+			break;
 		}
-		if (rej_match(db, archive_entry_pathname(entry)) > 0) {
-			weprintf("rejecting %s\n", archive_entry_pathname(entry));
+		name = pkg_entry_path(archive_entry_pathname(entry));
+		/* metadata is recorded in the db, not extracted */
+		if (strcmp(name, PKGDEPS) == 0)
+			continue;
+		if (st >= 0 && store_eligible(entry, name)) {
+			if (pkg_store_entry(dbs, n, store, st, ar, entry, name, w, &u) < 0) {
+				ret = -1;
+				break;
+			}
 			continue;
 		}
-		flags = ARCHIVE_EXTRACT_OWNER | ARCHIVE_EXTRACT_PERM |
-			ARCHIVE_EXTRACT_TIME | ARCHIVE_EXTRACT_SECURE_NODOTDOT;
-		if (fflag == 1)
-			flags |= ARCHIVE_EXTRACT_UNLINK;
-		r = archive_read_extract(ar, entry, flags);
-		if (r != ARCHIVE_OK && r != ARCHIVE_WARN)
-			weprintf("archive_read_extract %s: %s\n",
-				 archive_entry_pathname(entry), archive_error_string(ar));
+		link = archive_entry_hardlink(entry);
+		for (i = 0; i < n; i++) {
+			skip[i] = 1;
+			if (rej_match(dbs[i], archive_entry_pathname(entry)) > 0) {
+				weprintf("rejecting %s\n", archive_entry_pathname(entry));
+				continue;
+			}
+			/* the entry is written relative to the root of each db */
+			e = archive_entry_clone(entry);
+			db_entry_path(dbs[i], name, path, sizeof(path));
+			archive_entry_copy_pathname(e, path);
+			if (link) {
+				db_entry_path(dbs[i], pkg_entry_path(link), path, sizeof(path));
+				archive_entry_copy_hardlink(e, path);
+			}
+			/* directories which exist already are kept */
+			db_entry_path(dbs[i], name, path, sizeof(path));
+			if (archive_entry_filetype(entry) != AE_IFDIR ||
+			    lstat(path, &sb) < 0)
+				undo_add(&u, path);
+			r = archive_write_header(w[i], e);
+			archive_entry_free(e);
+			if (r != ARCHIVE_OK && r != ARCHIVE_WARN) {
+				weprintf("archive_write_header %s: %s\n",
+					 name, archive_error_string(w[i]));
+				ret = -1;
+				break;
+			}
+			skip[i] = 0;
+			prof_count(PROF_FILES, 1);
+			if (archive_entry_filetype(entry) == AE_IFREG)
+				prof_count(PROF_BYTES_OUT, archive_entry_size(entry));
+		}
+		if (ret < 0)
+			break;
+		if (archive_entry_size(entry) > 0 &&
+		    pkg_copy_data(ar, w, skip, n) < 0) {
+			ret = -1;
+			break;
+		}
+		for (i = 0; i < n; i++) {
+			if (skip[i])
+				continue;
+			r = archive_write_finish_entry(w[i]);
+			if (r != ARCHIVE_OK && r != ARCHIVE_WARN) {
+				weprintf("archive_write_finish_entry %s: %s\n",
+					 name, archive_error_string(w[i]));
+				ret = -1;
+			}
+		}
+		if (ret < 0)
+			break;
 	}
 
-	archive_read_free(ar);
-
-	if (chdir(cwd) < 0) {
-		weprintf("chdir %s:", cwd);
-		return -1;
+	prof_count(PROF_BYTES_IN, archive_filter_bytes(ar, 0));
+	pkg_archive_close(ar, fd);
+	for (i = 0; i < n; i++) {
+		if (archive_write_close(w[i]) != ARCHIVE_OK)
+			weprintf("archive_write_close: %s\n",
+				 archive_error_string(w[i]));
+		archive_write_free(w[i]);
 	}
+	free(w);
+	free(skip);
+	free(store);
+	undo_run(&u, ret < 0);
 
-	return 0;
+	prof_end(PROF_EXTRACT);
+	return ret;
 }
 
 static int
@@ -220,6 +568,7 @@ pkg_remove(struct db *db, struct pkg *pkg)
 	struct pkgentry *pe;
 	struct stat sb;
 
+	prof_begin(PROF_REMOVE);
 	TAILQ_FOREACH_REVERSE(pe, &pkg->pe_head, pe_head, entry) {
 		if (rej_match(db, pe->rpath) > 0) {
 			weprintf("rejecting %s\n", pe->rpath);
@@ -249,51 +598,81 @@ pkg_remove(struct db *db, struct pkg *pkg)
 			printf("removing %s\n", pe->path);
 		if (remove(pe->path) < 0)
 			weprintf("remove %s:", pe->path);
+		prof_count(PROF_FILES, 1);
 	}
 
-	if (fflag == 1) {
-		/* prune empty directories as well */
+	TAILQ_REMOVE(&db->pkg_head, pkg, entry);
+	TAILQ_INSERT_TAIL(&db->pkg_rm_head, pkg, entry);
+	htab_del(db->names, pkg->name, pkg);
+
+	prof_end(PROF_REMOVE);
+	return 0;
+}
+
+/* Prune the empty directories of all packages removed so far which
+ * are not referenced by an installed package.  Doing this once after
+ * a batch of pkg_remove() calls visits every directory only once. */
+int
+pkg_prune(struct db *db)
+{
+	struct htab *links, *seen;
+	struct pkg *pkg;
+	struct pkgentry *pe;
+
+	prof_begin(PROF_REMOVE);
+	links = htab_new(1024);
+	TAILQ_FOREACH(pkg, &db->pkg_head, entry)
+		TAILQ_FOREACH(pe, &pkg->pe_head, entry)
+			htab_add(links, pe->path, pkg);
+
+	seen = htab_new(1024);
+	TAILQ_FOREACH(pkg, &db->pkg_rm_head, entry) {
 		TAILQ_FOREACH_REVERSE(pe, &pkg->pe_head, pe_head, entry) {
-			if (rej_match(db, pe->rpath) > 0)
+			if (htab_get(links, pe->path) || htab_get(seen, pe->path))
 				continue;
-			if (db_links(db, pe->path) > 1)
+			htab_add(seen, pe->path, pkg);
+			if (rej_match(db, pe->rpath) > 0)
 				continue;
 			nftw(pe->path, rm_empty_dir, 1, FTW_DEPTH);
 		}
 	}
+	htab_free(seen);
+	htab_free(links);
 
-	TAILQ_REMOVE(&db->pkg_head, pkg, entry);
-	TAILQ_INSERT_TAIL(&db->pkg_rm_head, pkg, entry);
-
+	prof_end(PROF_REMOVE);
 	return 0;
 }
 
-/* Check if the file entries of the package
- * collide with corresponding entries in the filesystem */
+/* Check if the file entries of the package collide with
+ * corresponding entries in the filesystem below the db root */
 int
-pkg_collisions(struct pkg *pkg)
+pkg_collisions(struct db *db, struct pkg *pkg)
 {
 	struct pkgentry *pe;
 	struct stat sb;
-	char resolvedpath[PATH_MAX];
+	char path[PATH_MAX], resolvedpath[PATH_MAX];
 	int r = 0;
 
+	prof_begin(PROF_COLLISIONS);
 	TAILQ_FOREACH(pe, &pkg->pe_head, entry) {
-		if (access(pe->path, F_OK) == 0) {
-			if (stat(pe->path, &sb) < 0) {
-				weprintf("lstat %s:", pe->path);
+		db_entry_path(db, pe->rpath, path, sizeof(path));
+		if (access(path, F_OK) == 0) {
+			if (stat(path, &sb) < 0) {
+				weprintf("lstat %s:", path);
+				prof_end(PROF_COLLISIONS);
 				return -1;
 			}
 			if (S_ISDIR(sb.st_mode) == 0) {
-				if (realpath(pe->path, resolvedpath))
+				if (realpath(path, resolvedpath))
 					weprintf("%s exists\n", resolvedpath);
 				else
-					weprintf("%s exists\n", pe->path);
+					weprintf("%s exists\n", path);
 				r = -1;
 			}
 		}
 	}
 
+	prof_end(PROF_COLLISIONS);
 	return r;
 }
 
@@ -309,7 +688,10 @@ pkg_new(const char *path, const char *name, const char *version)
 	else
 		pkg->version = NULL;
 	estrlcpy(pkg->path, path, sizeof(pkg->path));
+	pkg->level = 0;
+	pkg->size = -1;
 	TAILQ_INIT(&pkg->pe_head);
+	TAILQ_INIT(&pkg->pd_head);
 	return pkg;
 }
 
@@ -317,12 +699,18 @@ void
 pkg_free(struct pkg *pkg)
 {
 	struct pkgentry *pe, *tmp;
+	struct pkgdep *pd, *pdtmp;
 
 	for (pe = TAILQ_FIRST(&pkg->pe_head); pe; pe = tmp) {
 		tmp = TAILQ_NEXT(pe, entry);
 		TAILQ_REMOVE(&pkg->pe_head, pe, entry);
 		pkgentry_free(pe);
 	}
+	for (pd = TAILQ_FIRST(&pkg->pd_head); pd; pd = pdtmp) {
+		pdtmp = TAILQ_NEXT(pd, entry);
+		TAILQ_REMOVE(&pkg->pd_head, pd, entry);
+		pkgdep_free(pd);
+	}
 	free(pkg->name);
 	free(pkg->version);
 	free(pkg);
@@ -334,10 +722,15 @@ pkgentry_new(struct db *db, const char *file)
 	struct pkgentry *pe;
 
 	pe = emalloc(sizeof(*pe));
-	estrlcpy(pe->path, db->root, sizeof(pe->path));
-	estrlcat(pe->path, "/", sizeof(pe->path));
-	estrlcat(pe->path, file, sizeof(pe->path));
-	estrlcpy(pe->rpath, file, sizeof(pe->rpath));
+	pe->size = 0;
+	strlcpy(pe->path, db->root, sizeof(pe->path));
+	strlcat(pe->path, "/", sizeof(pe->path));
+	if (strlcat(pe->path, file, sizeof(pe->path)) >= sizeof(pe->path) ||
+	    strlcpy(pe->rpath, file, sizeof(pe->rpath)) >= sizeof(pe->rpath)) {
+		weprintf("%s: path too long\n", file);
+		free(pe);
+		return NULL;
+	}
 	return pe;
 }
 
@@ -346,3 +739,20 @@ pkgentry_free(struct pkgentry *pe)
 {
 	free(pe);
 }
+
+struct pkgdep *
+pkgdep_new(const char *name)
+{
+	struct pkgdep *pd;
+
+	pd = emalloc(sizeof(*pd));
+	pd->name = estrdup(name);
+	return pd;
+}
+
+void
+pkgdep_free(struct pkgdep *pd)
+{
+	free(pd->name);
+	free(pd);
+}
@@ -2,16 +2,20 @@
 #include <archive.h>
 #include <archive_entry.h>
 #include <dirent.h>
+#include <errno.h>
 #include <ftw.h>
 #include <limits.h>
 #include <regex.h>
 #include <signal.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
 #include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 #include <unistd.h>
 #include "arg.h"
 #include "queue.h"
@@ -20,19 +24,35 @@
 
 #define DBPATH        "/var/pkg"
 #define DBPATHREJECT  "/etc/pkgtools/reject.conf"
-#define ARCHIVEBUFSIZ BUFSIZ
+#define DBPATHMETA    ".meta"		/* per-package metadata, relative to DBPATH */
+#define PKGDEPS       ".pkgdeps"	/* dependency list inside a .pkg.tgz */
+#define COMPACTMAGIC  "\0pkgfc1\n"	/* header of compact db records */
+#define PKGDSOCK      ".pkgd.sock"	/* pkgd query socket, relative to DBPATH */
+#define DBPATHOBJECTS "objects"	/* content addressed store, relative to DBPATH */
+#define SHA256_HEXLEN 64
+#define STOREKEYLEN   (SHA256_HEXLEN + 48)	/* <sha256>.<mode>.<uid>.<gid> */
+#define ARCHIVEBUFSIZ (128 * 1024)	/* archive read size, the default readahead window */
 
 struct pkgentry {
 	char path[PATH_MAX];		/* absolute path of package entry */
 	char rpath[PATH_MAX];		/* relative path of package entry */
+	off_t size;			/* data size in the archive, 0 in db records */
 	TAILQ_ENTRY(pkgentry) entry;
 };
 
+struct pkgdep {
+	char *name;			/* name of the required package */
+	TAILQ_ENTRY(pkgdep) entry;
+};
+
 struct pkg {
 	char *name;			/* package name */
 	char *version;			/* package version */
 	char path[PATH_MAX];		/* path to package in db or .pkg.tgz */
+	int level;			/* install wave computed by the planner */
+	off_t size;			/* installed size in bytes, -1 if not recorded */
 	TAILQ_HEAD(pe_head, pkgentry) pe_head;
+	TAILQ_HEAD(pd_head, pkgdep) pd_head;
 	TAILQ_ENTRY(pkg) entry;
 };
 
@@ -41,6 +61,25 @@ struct rejrule {
 	TAILQ_ENTRY(rejrule) entry;
 };
 
+struct hent {
+	const char *key;
+	void *val;
+	struct hent *next;
+};
+
+struct htab {
+	struct hent **tab;		/* buckets, a power of two */
+	size_t sz;			/* number of buckets */
+	size_t n;			/* number of entries */
+};
+
+struct sha256 {
+	uint32_t h[8];
+	uint64_t len;			/* total length in bytes */
+	unsigned char buf[64];
+	size_t n;			/* bytes pending in buf */
+};
+
 struct db {
 	DIR *pkgdir;			/* opendir() handle for DBPATH */
 	char root[PATH_MAX];		/* db root to allow for installation in a mountpoint */
@@ -48,30 +87,66 @@ struct db {
 	TAILQ_HEAD(rejrule_head, rejrule) rejrule_head;
 	TAILQ_HEAD(pkg_head, pkg) pkg_head;
 	TAILQ_HEAD(pkg_rm_head, pkg) pkg_rm_head;
+	struct htab *names;		/* package name -> pkg in pkg_head */
+};
+
+/* prof.c phases and counters */
+enum {
+	PROF_DB_LOAD,
+	PROF_LOAD_FILE,
+	PROF_COLLISIONS,
+	PROF_EXTRACT,
+	PROF_REJ_MATCH,
+	PROF_DB_ADD,
+	PROF_FSYNC,
+	PROF_REMOVE,
+	PROF_DB_RM,
+	PROF_QUERY
+};
+
+enum {
+	PROF_BYTES_IN,
+	PROF_BYTES_OUT,
+	PROF_FILES
 };
 
 /* db.c */
+extern int cflag;
 extern int fflag;
 extern int vflag;
 
+/* prof.c */
+extern int Tflag;
+
 /* eprintf.c */
 extern char *argv0;
 
 /* common.c */
 void parse_db_name(const char *, char **);
 void parse_db_version(const char *, char **);
-void parse_name(const char *, char **);
-void parse_version(const char *, char **);
+int parse_name(const char *, char **);
+int parse_version(const char *, char **);
+int vercmp(const char *, const char *);
+
+/* compact.c */
+int compact_write(FILE *, struct pkg *);
+int compact_magic(const char *, size_t);
+int compact_read(struct db *, struct pkg *, const char *, size_t);
 
 /* db.c */
 struct db *db_new(const char *);
+void db_sigignore(void);
 int db_free(struct db *);
 int db_add(struct db *, struct pkg *);
 int db_rm(struct db *, struct pkg *);
+void db_sync(struct db *);
 int db_load(struct db *);
+int db_meta_load(struct db *, struct pkg *);
 struct pkg *pkg_load_file(struct db *, const char *);
+struct pkg *db_find(struct db *, const char *, const char *);
 int db_walk(struct db *, int (*)(struct db *, struct pkg *, void *), void *);
-int db_links(struct db *, const char *);
+void db_entry_path(struct db *, const char *, char *, size_t);
+int db_path_key(struct db *, const char *, char *, size_t);
 
 /* ealloc.c */
 void *ecalloc(size_t, size_t);
@@ -84,21 +159,68 @@ void enprintf(int, const char *, ...);
 void eprintf(const char *, ...);
 void weprintf(const char *, ...);
 
+/* hash.c */
+struct htab *htab_new(size_t);
+void htab_free(struct htab *);
+void htab_add(struct htab *, const char *, void *);
+int htab_del(struct htab *, const char *, void *);
+struct hent *htab_get(struct htab *, const char *);
+struct hent *htab_next(struct hent *);
+
 /* pkg.c */
 struct pkg *pkg_load(struct db *, const char *);
-int pkg_install(struct db *, struct pkg *);
+int pkg_install(struct db **, int, struct pkg *);
 int pkg_remove(struct db *, struct pkg *);
-int pkg_collisions(struct pkg *);
+int pkg_prune(struct db *);
+int pkg_collisions(struct db *, struct pkg *);
+void pkg_prefetch(struct pkg *);
 struct pkg *pkg_new(const char *, const char *, const char *);
 void pkg_free(struct pkg *);
 struct pkgentry *pkgentry_new(struct db *, const char *);
 void pkgentry_free(struct pkgentry *);
+struct pkgdep *pkgdep_new(const char *);
+void pkgdep_free(struct pkgdep *);
+
+/* plan.c */
+int plan_resolve(struct db *, struct pkg_head *);
+int plan_levels(struct pkg_head *);
+
+/* prof.c */
+void prof_init(void);
+void prof_reset(void);
+void prof_begin(int);
+void prof_end(int);
+void prof_count(int, unsigned long long);
+void prof_report(void);
+double prof_estimate(int, unsigned long long, unsigned long long);
+
+/* pkgdc.c */
+int pkgd_path(const char *, char *, size_t);
+int pkgd_query(const char *, const char *, const char *,
+	       int (*)(const char *, void *), void *);
 
 /* reject.c */
 void rej_free(struct db *);
 int rej_load(struct db *);
 int rej_match(struct db *, const char *);
 
+/* sha256.c */
+void sha256_init(struct sha256 *);
+void sha256_update(struct sha256 *, const void *, size_t);
+void sha256_hex(struct sha256 *, char *);
+
+/* store.c */
+int store_enabled(struct db *);
+int store_eligible(struct archive_entry *, const char *);
+void store_path(struct db *, const char *, char *, size_t);
+int store_spool(struct db *, struct archive *, struct archive_entry *, char *);
+int store_import(struct db *, const char *, const char *);
+int store_link(struct db *, const char *, const char *);
+int store_gc(struct db *);
+
+/* space.c */
+int space_check(struct db **, int, struct pkg_head *);
+
 /* strlcat.c */
 #undef strlcat
 size_t strlcat(char *, const char *, size_t);
@@ -0,0 +1,232 @@
+/* See LICENSE file for copyright and license details. */
+#include "pkg.h"
+
+static int isdir(struct dirent *, const char *);
+static void missing(void);
+static void visit(const char *, int, dev_t);
+static void walk(const char *, dev_t);
+
+static struct db *db;
+static struct htab *owners;		/* pkgentry path -> pkg */
+static size_t rootlen;
+static int uflag, mflag, aflag;
+
+static void
+usage(void)
+{
+	fprintf(stderr, VERSION " (c) 2014 morpheus engineers\n");
+	fprintf(stderr, "usage: %s [-u] [-m] [-a] [-j jobs] [-r path]\n", argv0);
+	fprintf(stderr, "  -u    Only report files not owned by any package\n");
+	fprintf(stderr, "  -m    Only report package files which are missing\n");
+	fprintf(stderr, "  -a    Also descend into other filesystems\n");
+	fprintf(stderr, "  -j    Walk up to jobs top-level directories concurrently\n");
+	fprintf(stderr, "  -r    Set alternative installation root\n");
+	exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+	DIR *dir;
+	struct dirent *dp;
+	struct stat sb;
+	struct pkg *pkg;
+	struct pkgentry *pe;
+	char path[PATH_MAX];
+	char *root = "/", *arg;
+	int jobs = 1, running = 0, status = 0, dirp, st;
+
+	ARGBEGIN {
+	case 'u':
+		uflag = 1;
+		break;
+	case 'm':
+		mflag = 1;
+		break;
+	case 'a':
+		aflag = 1;
+		break;
+	case 'j':
+		arg = ARGF();
+		if (!arg)
+			usage();
+		jobs = atoi(arg);
+		if (jobs < 1)
+			usage();
+		break;
+	case 'r':
+		root = ARGF();
+		break;
+	default:
+		usage();
+	} ARGEND;
+
+	if (argc > 0)
+		usage();
+	if (uflag == 0 && mflag == 0)
+		uflag = mflag = 1;
+
+	db = db_new(root);
+	if (!db)
+		exit(EXIT_FAILURE);
+	if (db_load(db) < 0) {
+		db_free(db);
+		exit(EXIT_FAILURE);
+	}
+	rootlen = strlen(db->root);
+
+	if (mflag == 1)
+		missing();
+	if (uflag == 0) {
+		db_free(db);
+		return EXIT_SUCCESS;
+	}
+
+	owners = htab_new(1024);
+	TAILQ_FOREACH(pkg, &db->pkg_head, entry)
+		TAILQ_FOREACH(pe, &pkg->pe_head, entry)
+			htab_add(owners, pe->path, pkg);
+
+	if (lstat(db->root, &sb) < 0 || !(dir = opendir(db->root)))
+		eprintf("opendir %s:", db->root);
+	/* the top-level directories are walked by separate workers,
+	 * the owner index is shared with them copy-on-write */
+	fflush(stdout);
+	setvbuf(stdout, NULL, _IOLBF, 0);
+	while ((dp = readdir(dir))) {
+		if (strcmp(dp->d_name, ".") == 0 || strcmp(dp->d_name, "..") == 0)
+			continue;
+		estrlcpy(path, db->root, sizeof(path));
+		estrlcat(path, "/", sizeof(path));
+		estrlcat(path, dp->d_name, sizeof(path));
+		dirp = isdir(dp, path);
+		if (jobs == 1 || !dirp) {
+			visit(path, dirp, sb.st_dev);
+			continue;
+		}
+		if (running == jobs) {
+			if (wait(&st) > 0 && (!WIFEXITED(st) || WEXITSTATUS(st) != 0))
+				status = -1;
+			running--;
+		}
+		switch (fork()) {
+		case -1:
+			weprintf("fork:");
+			visit(path, dirp, sb.st_dev);
+			break;
+		case 0:
+			visit(path, dirp, sb.st_dev);
+			fflush(stdout);
+			_exit(EXIT_SUCCESS);
+		default:
+			running++;
+			break;
+		}
+	}
+	for (; running > 0; running--)
+		if (wait(&st) > 0 && (!WIFEXITED(st) || WEXITSTATUS(st) != 0))
+			status = -1;
+	closedir(dir);
+
+	htab_free(owners);
+	db_free(db);
+
+	return status < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/* readdir() reports the type on most filesystems, avoid the lstat() */
+static int
+isdir(struct dirent *dp, const char *path)
+{
+	struct stat sb;
+
+	if (dp->d_type != DT_UNKNOWN)
+		return dp->d_type == DT_DIR;
+	return lstat(path, &sb) == 0 && S_ISDIR(sb.st_mode);
+}
+
+/* Print `path' the way the user sees it, without the doubled slash
+ * of entries below "/" */
+static const char *
+display(const char *path)
+{
+	return rootlen == 1 ? path + 1 : path;
+}
+
+/* Report package entries which no longer exist */
+static void
+missing(void)
+{
+	struct pkg *pkg;
+	struct pkgentry *pe;
+	struct stat sb;
+
+	TAILQ_FOREACH(pkg, &db->pkg_head, entry) {
+		TAILQ_FOREACH(pe, &pkg->pe_head, entry) {
+			/* rejected entries were never installed */
+			if (rej_match(db, pe->rpath) > 0)
+				continue;
+			if (lstat(pe->path, &sb) < 0 && errno == ENOENT)
+				printf("missing %s %s\n", pkg->name, display(pe->path));
+		}
+	}
+}
+
+/* Report `path' if no package owns it and descend into it if it is
+ * a directory.  `dev' is the device of the root. */
+static void
+visit(const char *path, int dir, dev_t dev)
+{
+	struct stat sb;
+	char key[PATH_MAX];
+	const char *rpath = path + rootlen + 1;
+	size_t len = strlen(rpath);
+	int owned;
+
+	if (rej_match(db, rpath) > 0 || strcmp(rpath, DBPATH + 1) == 0)
+		return;
+
+	/* the directories holding the db belong to no package */
+	if (dir && strncmp(DBPATH + 1, rpath, len) == 0 && DBPATH[len + 1] == '/')
+		owned = 1;
+	else
+		owned = htab_get(owners, path) != NULL;
+	if (!owned) {
+		/* directory entries keep their trailing slash */
+		estrlcpy(key, path, sizeof(key));
+		if (!dir || strlcat(key, "/", sizeof(key)) >= sizeof(key) ||
+		    !htab_get(owners, key))
+			printf("unowned %s\n", display(path));
+	}
+
+	if (!dir)
+		return;
+	if (aflag == 0 && (lstat(path, &sb) < 0 || sb.st_dev != dev))
+		return;
+	walk(path, dev);
+}
+
+static void
+walk(const char *path, dev_t dev)
+{
+	DIR *dir;
+	struct dirent *dp;
+	char sub[PATH_MAX];
+
+	if (!(dir = opendir(path))) {
+		weprintf("opendir %s:", path);
+		return;
+	}
+	while ((dp = readdir(dir))) {
+		if (strcmp(dp->d_name, ".") == 0 || strcmp(dp->d_name, "..") == 0)
+			continue;
+		estrlcpy(sub, path, sizeof(sub));
+		estrlcat(sub, "/", sizeof(sub));
+		if (strlcat(sub, dp->d_name, sizeof(sub)) >= sizeof(sub)) {
+			weprintf("%s/%s: path too long\n", path, dp->d_name);
+			continue;
+		}
+		visit(sub, isdir(dp, sub), dev);
+	}
+	closedir(dir);
+}
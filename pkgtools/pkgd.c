@@ -0,0 +1,452 @@
+/* See LICENSE file for copyright and license details. */
+#include <poll.h>
+#include <time.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "pkg.h"
+
+#define MAXCLIENTS	32
+#define CLIENTMS	200		/* time a client has to send its request */
+
+struct client {
+	int fd;				/* -1 if the slot is free */
+	long long deadline;		/* CLOCK_MONOTONIC ms */
+	size_t n;
+	char req[PATH_MAX + 16];
+};
+
+static void index_pkg(struct pkg *);
+static void unindex_pkg(struct pkg *);
+static void load(const char *);
+static void unload(const char *);
+static void reload(void);
+static void watch(int);
+static long long msnow(void);
+static void owner_slow(FILE *, const char *);
+static void client_new(int);
+static void client_read(struct client *);
+static void client_close(struct client *);
+static void serve(int, char *);
+
+static struct db *db;
+static struct htab *owners;		/* pkgentry path -> pkg */
+static struct client clients[MAXCLIENTS];
+static volatile sig_atomic_t running = 1;
+
+static void
+usage(void)
+{
+	fprintf(stderr, VERSION " (c) 2014 morpheus engineers\n");
+	fprintf(stderr, "usage: %s [-v] [-r path]\n", argv0);
+	fprintf(stderr, "  -v    Enable verbose output\n");
+	fprintf(stderr, "  -r    Set alternative installation root\n");
+	exit(EXIT_FAILURE);
+}
+
+static void
+sighandler(int sig)
+{
+	(void) sig;
+
+	running = 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct sockaddr_un sun;
+	struct sigaction sa;
+	struct pollfd pfd[2 + MAXCLIENTS];
+	struct client *slot[2 + MAXCLIENTS];
+	struct pkg *pkg;
+	char path[PATH_MAX];
+	char *root = "/";
+	long long now, timeout;
+	mode_t mask;
+	int sfd, ifd, cfd, i, n;
+
+	ARGBEGIN {
+	case 'v':
+		vflag = 1;
+		break;
+	case 'r':
+		root = ARGF();
+		break;
+	default:
+		usage();
+	} ARGEND;
+
+	if (argc > 0)
+		usage();
+
+	db = db_new(root);
+	if (!db)
+		exit(EXIT_FAILURE);
+
+	/* remove the socket on termination */
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = sighandler;
+	sigaction(SIGINT, &sa, 0);
+	sigaction(SIGTERM, &sa, 0);
+	sa.sa_handler = SIG_IGN;
+	sigaction(SIGPIPE, &sa, 0);
+
+	/* watch before loading so that no change is missed */
+	if ((ifd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0)
+		eprintf("inotify_init1:");
+	if (inotify_add_watch(ifd, db->path, IN_CLOSE_WRITE | IN_DELETE |
+			      IN_MOVED_FROM | IN_MOVED_TO) < 0)
+		eprintf("inotify_add_watch %s:", db->path);
+
+	if (db_load(db) < 0) {
+		db_free(db);
+		exit(EXIT_FAILURE);
+	}
+	owners = htab_new(1024);
+	TAILQ_FOREACH(pkg, &db->pkg_head, entry)
+		index_pkg(pkg);
+
+	if (pkgd_path(root, path, sizeof(path)) < 0)
+		eprintf("realpath %s:", root);
+	if (strlen(path) >= sizeof(sun.sun_path))
+		eprintf("%s: socket path too long\n", path);
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_UNIX;
+	estrlcpy(sun.sun_path, path, sizeof(sun.sun_path));
+
+	if ((sfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0)
+		eprintf("socket:");
+	unlink(path);
+	mask = umask(077);
+	if (bind(sfd, (struct sockaddr *)&sun, sizeof(sun)) < 0)
+		eprintf("bind %s:", path);
+	umask(mask);
+	/* only root may query, other users load the db themselves.  A
+	 * client which does not send its request in time is dropped, so
+	 * it cannot stall the others. */
+	if (chmod(path, 0600) < 0)
+		weprintf("chmod %s:", path);
+	if (listen(sfd, 64) < 0)
+		eprintf("listen %s:", path);
+	if (vflag == 1)
+		printf("listening on %s\n", path);
+
+	for (i = 0; i < MAXCLIENTS; i++)
+		clients[i].fd = -1;
+	while (running) {
+		pfd[0].fd = sfd;
+		pfd[0].events = POLLIN;
+		pfd[1].fd = ifd;
+		pfd[1].events = POLLIN;
+		n = 2;
+		timeout = -1;
+		now = msnow();
+		for (i = 0; i < MAXCLIENTS; i++) {
+			if (clients[i].fd < 0)
+				continue;
+			if (clients[i].deadline <= now) {
+				client_close(&clients[i]);
+				continue;
+			}
+			if (timeout < 0 || clients[i].deadline - now < timeout)
+				timeout = clients[i].deadline - now;
+			pfd[n].fd = clients[i].fd;
+			pfd[n].events = POLLIN;
+			slot[n++] = &clients[i];
+		}
+		if (poll(pfd, n, timeout) < 0) {
+			if (errno == EINTR)
+				continue;
+			weprintf("poll:");
+			break;
+		}
+		/* apply db changes before answering queries */
+		if (pfd[1].revents & POLLIN)
+			watch(ifd);
+		for (i = 2; i < n; i++)
+			if (pfd[i].revents)
+				client_read(slot[i]);
+		if (pfd[0].revents & POLLIN) {
+			if ((cfd = accept4(sfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) < 0) {
+				if (errno != EINTR && errno != EAGAIN)
+					weprintf("accept:");
+				continue;
+			}
+			client_new(cfd);
+		}
+	}
+
+	for (i = 0; i < MAXCLIENTS; i++)
+		if (clients[i].fd >= 0)
+			client_close(&clients[i]);
+	unlink(path);
+	close(sfd);
+	close(ifd);
+	htab_free(owners);
+	db_free(db);
+
+	return EXIT_SUCCESS;
+}
+
+static void
+index_pkg(struct pkg *pkg)
+{
+	struct pkgentry *pe;
+
+	TAILQ_FOREACH(pe, &pkg->pe_head, entry)
+		htab_add(owners, pe->path, pkg);
+}
+
+static void
+unindex_pkg(struct pkg *pkg)
+{
+	struct pkgentry *pe;
+
+	TAILQ_FOREACH(pe, &pkg->pe_head, entry)
+		htab_del(owners, pe->path, pkg);
+}
+
+/* Return the package whose db entry is `file', e.g. pkg#version */
+static struct pkg *
+find(const char *file)
+{
+	struct pkg *pkg;
+	char *p;
+
+	TAILQ_FOREACH(pkg, &db->pkg_head, entry) {
+		p = strrchr(pkg->path, '/');
+		if (strcmp(p ? p + 1 : pkg->path, file) == 0)
+			return pkg;
+	}
+	return NULL;
+}
+
+static void
+load(const char *file)
+{
+	struct pkg *pkg;
+
+	if (!(pkg = pkg_load(db, file)))
+		return;
+	if (vflag == 1)
+		printf("loaded %s\n", pkg->path);
+	TAILQ_INSERT_TAIL(&db->pkg_head, pkg, entry);
+	htab_add(db->names, pkg->name, pkg);
+	index_pkg(pkg);
+}
+
+static void
+unload(const char *file)
+{
+	struct pkg *pkg;
+
+	if (!(pkg = find(file)))
+		return;
+	if (vflag == 1)
+		printf("unloaded %s\n", pkg->path);
+	unindex_pkg(pkg);
+	htab_del(db->names, pkg->name, pkg);
+	TAILQ_REMOVE(&db->pkg_head, pkg, entry);
+	pkg_free(pkg);
+}
+
+/* Throw away the in-memory db and load it again from scratch */
+static void
+reload(void)
+{
+	struct pkg *pkg, *tmp;
+
+	for (pkg = TAILQ_FIRST(&db->pkg_head); pkg; pkg = tmp) {
+		tmp = TAILQ_NEXT(pkg, entry);
+		unindex_pkg(pkg);
+		htab_del(db->names, pkg->name, pkg);
+		TAILQ_REMOVE(&db->pkg_head, pkg, entry);
+		pkg_free(pkg);
+	}
+	rewinddir(db->pkgdir);
+	if (db_load(db) < 0)
+		weprintf("db_load %s: failed\n", db->path);
+	TAILQ_FOREACH(pkg, &db->pkg_head, entry)
+		index_pkg(pkg);
+}
+
+/* Apply the changes installpkg and removepkg made to the db */
+static void
+watch(int ifd)
+{
+	char buf[BUFSIZ * 4]
+		__attribute__((aligned(__alignof__(struct inotify_event))));
+	struct inotify_event *ev;
+	ssize_t len;
+	char *p;
+
+	while ((len = read(ifd, buf, sizeof(buf))) > 0) {
+		for (p = buf; p < buf + len; p += sizeof(*ev) + ev->len) {
+			ev = (struct inotify_event *)p;
+			if (ev->mask & IN_Q_OVERFLOW) {
+				reload();
+				continue;
+			}
+			if (ev->len == 0 || ev->name[0] == '.')
+				continue;
+			unload(ev->name);
+			if (ev->mask & (IN_CLOSE_WRITE | IN_MOVED_TO))
+				load(ev->name);
+		}
+	}
+}
+
+/* Look `path' up in the owner index */
+static struct hent *
+owner_get(const char *path)
+{
+	char key[PATH_MAX];
+	struct hent *he;
+
+	if (db_path_key(db, path, key, sizeof(key)) < 0)
+		return NULL;
+	if ((he = htab_get(owners, key)))
+		return he;
+	/* directory entries keep their trailing slash */
+	if (strlcat(key, "/", sizeof(key)) >= sizeof(key))
+		return NULL;
+	return htab_get(owners, key);
+}
+
+/* Fall back to comparing inodes, the way infopkg -o does, for paths
+ * which reach a package entry through a hardlink or a symlinked
+ * directory */
+static void
+owner_slow(FILE *fp, const char *path)
+{
+	struct pkg *pkg;
+	struct pkgentry *pe;
+	struct stat sb1, sb2;
+
+	if (lstat(path, &sb1) < 0) {
+		fprintf(fp, "error lstat %s: %s\n", path, strerror(errno));
+		return;
+	}
+	TAILQ_FOREACH(pkg, &db->pkg_head, entry) {
+		TAILQ_FOREACH(pe, &pkg->pe_head, entry) {
+			if (lstat(pe->path, &sb2) < 0)
+				continue;
+			if (sb1.st_dev == sb2.st_dev &&
+			    sb1.st_ino == sb2.st_ino) {
+				fprintf(fp, "%s\n", pkg->name);
+				break;
+			}
+		}
+	}
+}
+
+static long long
+msnow(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+/* Take `cfd' into a free slot, or the slot of the client closest to
+ * its deadline */
+static void
+client_new(int cfd)
+{
+	struct client *c = NULL;
+	int i;
+
+	for (i = 0; i < MAXCLIENTS; i++) {
+		if (clients[i].fd < 0) {
+			c = &clients[i];
+			break;
+		}
+		if (!c || clients[i].deadline < c->deadline)
+			c = &clients[i];
+	}
+	if (c->fd >= 0)
+		client_close(c);
+	c->fd = cfd;
+	c->n = 0;
+	c->deadline = msnow() + CLIENTMS;
+}
+
+static void
+client_close(struct client *c)
+{
+	close(c->fd);
+	c->fd = -1;
+}
+
+/* Read what `c' sent so far and answer once its request is complete */
+static void
+client_read(struct client *c)
+{
+	struct timeval tv = { 0, CLIENTMS * 1000 };
+	ssize_t r;
+	char *p;
+
+	r = read(c->fd, c->req + c->n, sizeof(c->req) - 1 - c->n);
+	if (r < 0 && (errno == EAGAIN || errno == EINTR))
+		return;
+	if (r > 0)
+		c->n += r;
+	c->req[c->n] = '\0';
+	if (r > 0 && !(p = memchr(c->req, '\n', c->n)) &&
+	    c->n < sizeof(c->req) - 1)
+		return;
+	if (r < 0) {
+		client_close(c);
+		return;
+	}
+	/* the answer is written blocking, but not for longer than a
+	 * client may take for its request */
+	fcntl(c->fd, F_SETFL, 0);
+	setsockopt(c->fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+	serve(c->fd, c->req);
+	c->fd = -1;
+}
+
+/* Answer a single request and close `cfd'.  The protocol is one line
+ * per request:
+ *   owner <path>  names of the packages owning <path>
+ *   name <name>   db entries (name#version) of package <name>
+ *   list          db entries of all installed packages
+ * The answer is one line per result, errors start with "error ". */
+static void
+serve(int cfd, char *req)
+{
+	struct pkg *pkg;
+	struct hent *he;
+	char *arg, *p;
+	FILE *fp;
+
+	if ((p = strchr(req, '\n')))
+		*p = '\0';
+	if ((arg = strchr(req, ' ')))
+		*arg++ = '\0';
+
+	if (!(fp = fdopen(cfd, "w"))) {
+		close(cfd);
+		return;
+	}
+
+	if (strcmp(req, "owner") == 0 && arg) {
+		if (!(he = owner_get(arg)))
+			owner_slow(fp, arg);
+		for (; he; he = htab_next(he))
+			fprintf(fp, "%s\n", ((struct pkg *)he->val)->name);
+	} else if (strcmp(req, "name") == 0 && arg) {
+		for (he = htab_get(db->names, arg); he; he = htab_next(he))
+			fprintf(fp, "%s\n", strrchr(((struct pkg *)he->val)->path, '/') + 1);
+	} else if (strcmp(req, "list") == 0) {
+		TAILQ_FOREACH(pkg, &db->pkg_head, entry)
+			fprintf(fp, "%s\n", strrchr(pkg->path, '/') + 1);
+	} else {
+		fprintf(fp, "error unknown request %s\n", req);
+	}
+
+	fclose(fp);
+}
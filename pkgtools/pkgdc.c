@@ -0,0 +1,70 @@
+/* See LICENSE file for copyright and license details. */
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "pkg.h"
+
+/* Build the path of the pkgd socket for the given root */
+int
+pkgd_path(const char *root, char *path, size_t sz)
+{
+	char rpath[PATH_MAX];
+
+	if (!realpath(root, rpath))
+		return -1;
+	estrlcpy(path, rpath, sz);
+	estrlcat(path, DBPATH "/" PKGDSOCK, sz);
+	return 0;
+}
+
+/* Send the request `cmd arg' to the pkgd serving `root' and call
+ * `cb' for every line of the answer.  Returns -1 if no pkgd is
+ * running so that the caller can fall back to loading the db, and
+ * -2 if the query itself failed. */
+int
+pkgd_query(const char *root, const char *cmd, const char *arg,
+	   int (*cb)(const char *, void *), void *data)
+{
+	struct sockaddr_un sun;
+	char path[PATH_MAX];
+	char *buf = NULL;
+	size_t sz = 0;
+	ssize_t len;
+	FILE *fp;
+	int fd, r = 0;
+
+	if (pkgd_path(root, path, sizeof(path)) < 0 ||
+	    strlen(path) >= sizeof(sun.sun_path))
+		return -1;
+
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_UNIX;
+	estrlcpy(sun.sun_path, path, sizeof(sun.sun_path));
+
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+		return -1;
+	if (connect(fd, (struct sockaddr *)&sun, sizeof(sun)) < 0) {
+		close(fd);
+		return -1;
+	}
+	if (dprintf(fd, "%s%s%s\n", cmd, arg ? " " : "", arg ? arg : "") < 0 ||
+	    shutdown(fd, SHUT_WR) < 0 || !(fp = fdopen(fd, "r"))) {
+		close(fd);
+		return -1;
+	}
+
+	while ((len = getline(&buf, &sz, fp)) != -1) {
+		if (len > 0 && buf[len - 1] == '\n')
+			buf[len - 1] = '\0';
+		if (strncmp(buf, "error ", 6) == 0) {
+			weprintf("pkgd: %s\n", buf + 6);
+			r = -1;
+			continue;
+		}
+		if (r == 0 && cb(buf, data) < 0)
+			r = -1;
+	}
+	free(buf);
+	fclose(fp);
+
+	return r < 0 ? -2 : 0;
+}
@@ -0,0 +1,158 @@
+/* See LICENSE file for copyright and license details. */
+#include "pkg.h"
+
+#define PLAN_UNVISITED	-2
+#define PLAN_VISITING	-1
+
+static struct pkg *
+plan_find(struct pkg_head *head, const char *name)
+{
+	struct pkg *pkg;
+
+	TAILQ_FOREACH(pkg, head, entry)
+		if (strcmp(pkg->name, name) == 0)
+			return pkg;
+	return NULL;
+}
+
+/* Look for an archive of package `name' in directory `dir'.
+ * If several versions are available the newest one is chosen. */
+static int
+plan_search(const char *dir, const char *name, char *path, size_t sz)
+{
+	DIR *dirp;
+	struct dirent *dp;
+	char best[PATH_MAX] = "", bestver[PATH_MAX], ver[PATH_MAX];
+	const char *p, *suffix;
+	size_t len = strlen(name);
+	int found = 0;
+
+	if (!(dirp = opendir(dir))) {
+		weprintf("opendir %s:", dir);
+		return -1;
+	}
+	while ((dp = readdir(dirp))) {
+		if (strncmp(dp->d_name, name, len) != 0)
+			continue;
+		p = &dp->d_name[len];
+		if (*p != '#' && strncmp(p, ".pkg.", 5) != 0)
+			continue;
+		if (!(suffix = strstr(p, ".pkg.")))
+			continue;
+		/* an archive without a version sorts before any other */
+		ver[0] = '\0';
+		if (*p == '#') {
+			if ((size_t)(suffix - p) > sizeof(ver))
+				continue;
+			memcpy(ver, p + 1, suffix - p - 1);
+			ver[suffix - p - 1] = '\0';
+		}
+		if (found && (ver[0] == '\0' ||
+		    (bestver[0] != '\0' && vercmp(ver, bestver) <= 0)))
+			continue;
+		if (strlcpy(best, dp->d_name, sizeof(best)) >= sizeof(best))
+			continue;
+		strcpy(bestver, ver);
+		found = 1;
+	}
+	closedir(dirp);
+
+	if (!found)
+		return -1;
+	estrlcpy(path, dir, sz);
+	estrlcat(path, "/", sz);
+	estrlcat(path, best, sz);
+	return 0;
+}
+
+/* Compute the transitive closure of the dependencies of the
+ * packages in `head'.  Dependencies which are neither installed
+ * nor already part of the plan are looked up in the directory of
+ * the package requiring them and appended to `head'. */
+int
+plan_resolve(struct db *db, struct pkg_head *head)
+{
+	struct pkg *pkg, *dep;
+	struct pkgdep *pd;
+	char dir[PATH_MAX], path[PATH_MAX], *p;
+	int r = 0;
+
+	TAILQ_FOREACH(pkg, head, entry) {
+		estrlcpy(dir, pkg->path, sizeof(dir));
+		if ((p = strrchr(dir, '/')))
+			*p = '\0';
+		TAILQ_FOREACH(pd, &pkg->pd_head, entry) {
+			if (plan_find(head, pd->name))
+				continue;
+			if (db_find(db, pd->name, NULL))
+				continue;
+			if (plan_search(dir, pd->name, path, sizeof(path)) < 0) {
+				weprintf("%s: unresolved dependency %s\n",
+					 pkg->name, pd->name);
+				r = -1;
+				continue;
+			}
+			if (vflag == 1)
+				printf("%s requires %s\n", pkg->name, path);
+			dep = pkg_load_file(db, path);
+			if (!dep)
+				return -1;
+			TAILQ_INSERT_TAIL(head, dep, entry);
+		}
+	}
+
+	return r;
+}
+
+static int
+plan_visit(struct pkg_head *head, struct pkg *pkg)
+{
+	struct pkg *dep;
+	struct pkgdep *pd;
+	int r;
+
+	if (pkg->level == PLAN_VISITING) {
+		weprintf("%s: dependency cycle\n", pkg->name);
+		return -1;
+	}
+	if (pkg->level != PLAN_UNVISITED)
+		return pkg->level;
+
+	pkg->level = PLAN_VISITING;
+	r = 0;
+	TAILQ_FOREACH(pd, &pkg->pd_head, entry) {
+		dep = plan_find(head, pd->name);
+		if (!dep || dep == pkg)
+			continue;
+		if (plan_visit(head, dep) < 0)
+			return -1;
+		if (dep->level + 1 > r)
+			r = dep->level + 1;
+	}
+	pkg->level = r;
+
+	return r;
+}
+
+/* Assign each package an install level such that all of its
+ * dependencies in `head' have a lower level.  Packages sharing a
+ * level are independent of each other and may be installed
+ * concurrently.  Returns the highest level or -1 on a cycle. */
+int
+plan_levels(struct pkg_head *head)
+{
+	struct pkg *pkg;
+	int r, max = 0;
+
+	TAILQ_FOREACH(pkg, head, entry)
+		pkg->level = PLAN_UNVISITED;
+	TAILQ_FOREACH(pkg, head, entry) {
+		r = plan_visit(head, pkg);
+		if (r < 0)
+			return -1;
+		if (r > max)
+			max = r;
+	}
+
+	return max;
+}
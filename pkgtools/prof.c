@@ -0,0 +1,225 @@
+/* See LICENSE file for copyright and license details. */
+#include <fcntl.h>
+#include <time.h>
+#include "pkg.h"
+
+int Tflag = 0;
+
+struct phase {
+	const char *name;
+	int fine;			/* called per file, skip the syscall sampling */
+	int depth;			/* nesting of prof_begin() calls */
+	long calls;
+	struct timespec wall0, cpu0;
+	unsigned long long syscr0, syscw0, samples0;
+	double wall, cpu;
+	unsigned long long syscr, syscw;
+};
+
+static struct phase phases[] = {
+	[PROF_DB_LOAD]       = { "db_load",        0 },
+	[PROF_LOAD_FILE]     = { "pkg_load_file",  0 },
+	[PROF_COLLISIONS]    = { "pkg_collisions", 0 },
+	[PROF_EXTRACT]       = { "extract",        0 },
+	[PROF_REJ_MATCH]     = { "rej_match",      1 },
+	[PROF_DB_ADD]        = { "db_add",         0 },
+	[PROF_FSYNC]         = { "fsync",          0 },
+	[PROF_REMOVE]        = { "pkg_remove",     0 },
+	[PROF_DB_RM]         = { "db_rm",          0 },
+	[PROF_QUERY]         = { "query",          0 },
+};
+
+static const char *counters[] = {
+	[PROF_BYTES_IN]  = "bytes_decompressed",
+	[PROF_BYTES_OUT] = "bytes_written",
+	[PROF_FILES]     = "files",
+};
+
+static unsigned long long counts[LEN(counters)];
+static struct timespec start;
+static unsigned long long samples;	/* reads of /proc/self/io so far */
+static int json = 0;
+static int reported = 0;		/* prof_report() has run */
+
+static double
+elapsed(struct timespec *t0, struct timespec *t1)
+{
+	return (t1->tv_sec - t0->tv_sec) + (t1->tv_nsec - t0->tv_nsec) / 1e9;
+}
+
+/* Read the read/write syscall counters from /proc/self/io */
+static void
+prof_sys(unsigned long long *syscr, unsigned long long *syscw)
+{
+	char buf[512], *p;
+	ssize_t n;
+	int fd;
+
+	*syscr = *syscw = 0;
+	if ((fd = open("/proc/self/io", O_RDONLY)) < 0)
+		return;
+	n = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	samples++;
+	if (n <= 0)
+		return;
+	buf[n] = '\0';
+	if ((p = strstr(buf, "syscr:")))
+		*syscr = strtoull(p + 6, NULL, 10);
+	if ((p = strstr(buf, "syscw:")))
+		*syscw = strtoull(p + 6, NULL, 10);
+}
+
+/* Enable profiling if -T was given or PKGTOOLS_TIMING is set.
+ * PKGTOOLS_TIMING=json selects JSON lines output. */
+void
+prof_init(void)
+{
+	char *env;
+
+	env = getenv("PKGTOOLS_TIMING");
+	if (env && env[0] != '\0' && strcmp(env, "0") != 0)
+		Tflag = 1;
+	if (env && strcmp(env, "json") == 0)
+		json = 1;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	/* runs which fail and exit early are reported as well */
+	atexit(prof_report);
+}
+
+/* Forget what was collected so far, a forked child calls this to
+ * report only its own work */
+void
+prof_reset(void)
+{
+	size_t i;
+
+	for (i = 0; i < LEN(phases); i++) {
+		phases[i].calls = 0;
+		phases[i].wall = phases[i].cpu = 0;
+		phases[i].syscr = phases[i].syscw = 0;
+	}
+	memset(counts, 0, sizeof(counts));
+	samples = 0;
+	reported = 0;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+}
+
+void
+prof_begin(int ph)
+{
+	struct phase *p = &phases[ph];
+
+	if (Tflag == 0 || p->depth++ > 0)
+		return;
+	p->calls++;
+	if (p->fine == 0) {
+		prof_sys(&p->syscr0, &p->syscw0);
+		p->samples0 = samples;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &p->wall0);
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &p->cpu0);
+}
+
+void
+prof_end(int ph)
+{
+	struct phase *p = &phases[ph];
+	struct timespec wall, cpu;
+	unsigned long long syscr, syscw, own;
+
+	if (Tflag == 0 || --p->depth > 0)
+		return;
+	clock_gettime(CLOCK_MONOTONIC, &wall);
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu);
+	p->wall += elapsed(&p->wall0, &wall);
+	p->cpu += elapsed(&p->cpu0, &cpu);
+	if (p->fine == 0) {
+		/* do not account for our own reads of /proc/self/io */
+		own = samples - p->samples0 + 1;
+		prof_sys(&syscr, &syscw);
+		if (syscr >= p->syscr0 + own)
+			p->syscr += syscr - p->syscr0 - own;
+		p->syscw += syscw - p->syscw0;
+	}
+}
+
+void
+prof_count(int c, unsigned long long n)
+{
+	if (Tflag == 1)
+		counts[c] += n;
+}
+
+/* Print the collected statistics to stderr */
+void
+prof_report(void)
+{
+	struct phase *p;
+	struct timespec now, cpu;
+	unsigned long long syscr, syscw;
+	size_t i;
+
+	if (Tflag == 0 || reported == 1)
+		return;
+	reported = 1;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu);
+	prof_sys(&syscr, &syscw);
+	if (syscr >= samples - 1)
+		syscr -= samples - 1;
+
+	if (json == 0)
+		fprintf(stderr, "%-16s %8s %10s %10s %8s %8s\n",
+			"phase", "calls", "wall", "cpu", "syscr", "syscw");
+	for (i = 0; i < LEN(phases); i++) {
+		p = &phases[i];
+		if (p->calls == 0)
+			continue;
+		if (json == 1)
+			fprintf(stderr, "{\"tool\":\"%s\",\"pid\":%ld,\"phase\":\"%s\","
+				"\"calls\":%ld,\"wall\":%.6f,\"cpu\":%.6f",
+				argv0, (long)getpid(), p->name, p->calls,
+				p->wall, p->cpu);
+		else
+			fprintf(stderr, "%-16s %8ld %10.6f %10.6f",
+				p->name, p->calls, p->wall, p->cpu);
+		if (json == 1 && p->fine == 0)
+			fprintf(stderr, ",\"syscr\":%llu,\"syscw\":%llu}\n",
+				p->syscr, p->syscw);
+		else if (json == 1)
+			fprintf(stderr, "}\n");
+		else if (p->fine == 0)
+			fprintf(stderr, " %8llu %8llu\n", p->syscr, p->syscw);
+		else
+			fprintf(stderr, " %8s %8s\n", "-", "-");
+	}
+
+	if (json == 1) {
+		fprintf(stderr, "{\"tool\":\"%s\",\"pid\":%ld,\"phase\":\"total\","
+			"\"wall\":%.6f,\"cpu\":%.6f,\"syscr\":%llu,\"syscw\":%llu",
+			argv0, (long)getpid(), elapsed(&start, &now),
+			cpu.tv_sec + cpu.tv_nsec / 1e9, syscr, syscw);
+		for (i = 0; i < LEN(counters); i++)
+			fprintf(stderr, ",\"%s\":%llu", counters[i], counts[i]);
+		fprintf(stderr, "}\n");
+	} else {
+		fprintf(stderr, "%-16s %8s %10.6f %10.6f %8llu %8llu\n", "total", "",
+			elapsed(&start, &now), cpu.tv_sec + cpu.tv_nsec / 1e9,
+			syscr, syscw);
+		for (i = 0; i < LEN(counters); i++)
+			fprintf(stderr, "%-18s %llu\n", counters[i], counts[i]);
+	}
+}
+
+/* Crude guess of the time a dry run would take, in seconds: about
+ * 300us per extracted file plus writing at 100MB/s, and 15us per
+ * removed file.  These are rough assumed figures, not measurements,
+ * so the result only tells small runs from large ones. */
+double
+prof_estimate(int phase, unsigned long long bytes, unsigned long long files)
+{
+	if (phase == PROF_REMOVE)
+		return files * 15e-6;
+	return files * 300e-6 + bytes / 100e6;
+}
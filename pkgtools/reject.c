@@ -25,8 +25,11 @@ rej_load(struct db *db)
 	ssize_t len;
 	int r;
 
-	estrlcpy(rejpath, db->root, sizeof(rejpath));
-	estrlcat(rejpath, DBPATHREJECT, sizeof(rejpath));
+	if (strlcpy(rejpath, db->root, sizeof(rejpath)) >= sizeof(rejpath) ||
+	    strlcat(rejpath, DBPATHREJECT, sizeof(rejpath)) >= sizeof(rejpath)) {
+		weprintf("%s: path too long\n", db->root);
+		return -1;
+	}
 
 	if (!(fp = fopen(rejpath, "r")))
 		return -1;
@@ -73,9 +76,15 @@ int
 rej_match(struct db *db, const char *file)
 {
 	struct rejrule *rule;
+	int r = 0;
 
-	TAILQ_FOREACH(rule, &db->rejrule_head, entry)
-		if (regexec(&rule->preg, file, 0, NULL, 0) != REG_NOMATCH)
-			return 1;
-	return 0;
+	prof_begin(PROF_REJ_MATCH);
+	TAILQ_FOREACH(rule, &db->rejrule_head, entry) {
+		if (regexec(&rule->preg, file, 0, NULL, 0) != REG_NOMATCH) {
+			r = 1;
+			break;
+		}
+	}
+	prof_end(PROF_REJ_MATCH);
+	return r;
 }
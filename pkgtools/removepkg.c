@@ -1,15 +1,17 @@
 /* See LICENSE file for copyright and license details. */
 #include "pkg.h"
 
-static int pkg_remove_cb(struct db *, struct pkg *, void *);
+static void dryrun(struct db *);
 
 static void
 usage(void)
 {
 	fprintf(stderr, VERSION " (c) 2014 morpheus engineers\n");
-	fprintf(stderr, "usage: %s [-v] [-f] [-r path] pkg...\n", argv0);
+	fprintf(stderr, "usage: %s [-v] [-f] [-n] [-T] [-r path] pkg[#version]...\n", argv0);
 	fprintf(stderr, "  -v    Enable verbose output\n");
 	fprintf(stderr, "  -f    Force the removal of empty directories and symlinks\n");
+	fprintf(stderr, "  -n    Report what would be removed, remove nothing\n");
+	fprintf(stderr, "  -T    Print per-phase timing statistics\n");
 	fprintf(stderr, "  -r    Set alternative installation root\n");
 	exit(EXIT_FAILURE);
 }
@@ -18,9 +20,12 @@ int
 main(int argc, char *argv[])
 {
 	struct db *db;
-	char *root = "/";
+	struct pkg *pkg;
+	char *root = "/", *name, *version;
+	int nflag = 0;
 	int i, r;
 
+	prof_init();
 	ARGBEGIN {
 	case 'v':
 		vflag = 1;
@@ -28,6 +33,12 @@ main(int argc, char *argv[])
 	case 'f':
 		fflag = 1;
 		break;
+	case 'n':
+		nflag = 1;
+		break;
+	case 'T':
+		Tflag = 1;
+		break;
 	case 'r':
 		root = ARGF();
 		break;
@@ -41,6 +52,8 @@ main(int argc, char *argv[])
 	db = db_new(root);
 	if (!db)
 		exit(EXIT_FAILURE);
+	if (nflag == 0)
+		db_sigignore();
 	r = db_load(db);
 	if (r < 0) {
 		db_free(db);
@@ -48,30 +61,109 @@ main(int argc, char *argv[])
 	}
 
 	for (i = 0; i < argc; i++) {
-		r = db_walk(db, pkg_remove_cb, argv[i]);
-		if (r < 0) {
+		/* name or name#version */
+		parse_db_name(argv[i], &name);
+		parse_db_version(argv[i], &version);
+		pkg = db_find(db, name, version);
+		free(name);
+		free(version);
+		if (!pkg) {
+			printf("%s is not installed\n", argv[i]);
+			continue;
+		}
+		if (nflag == 1) {
+			TAILQ_REMOVE(&db->pkg_head, pkg, entry);
+			TAILQ_INSERT_TAIL(&db->pkg_rm_head, pkg, entry);
+			htab_del(db->names, pkg->name, pkg);
+			continue;
+		}
+		if (pkg_remove(db, pkg) < 0) {
+			db_free(db);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (nflag == 1) {
+		dryrun(db);
+		db_free(db);
+		prof_report();
+		return EXIT_SUCCESS;
+	}
+
+	/* prune directories once all packages are gone */
+	if (fflag == 1)
+		pkg_prune(db);
+
+	TAILQ_FOREACH(pkg, &db->pkg_rm_head, entry) {
+		if (db_rm(db, pkg) < 0) {
 			db_free(db);
 			exit(EXIT_FAILURE);
-		} else if (r == 0) {
-			printf("%s is not installed\n", argv[i]);
 		}
+		printf("removed %s\n", pkg->name);
 	}
+	db_sync(db);
+
+	/* drop objects no longer linked from the root */
+	if (store_enabled(db))
+		store_gc(db);
 
 	db_free(db);
+	prof_report();
 
 	return EXIT_SUCCESS;
 }
 
-static int
-pkg_remove_cb(struct db *db, struct pkg *pkg, void *name)
+/* Report what removing the packages in db->pkg_rm_head would do,
+ * following the rules of pkg_remove() and pkg_prune() */
+static void
+dryrun(struct db *db)
 {
-	if (strcmp(pkg->name, name) == 0) {
-		if (pkg_remove(db, pkg) < 0)
-			return -1;
-		if (db_rm(db, pkg) < 0)
-			return -1;
-		printf("removed %s\n", pkg->name);
-		return 1;
+	struct htab *links;
+	struct pkg *pkg;
+	struct pkgentry *pe;
+	struct stat sb;
+	unsigned long long files, bytes, dirs, kept, shared;
+	unsigned long long tfiles = 0, tbytes = 0, npkgs = 0;
+
+	/* entries still referenced once the packages are gone */
+	links = htab_new(1024);
+	TAILQ_FOREACH(pkg, &db->pkg_head, entry)
+		TAILQ_FOREACH(pe, &pkg->pe_head, entry)
+			htab_add(links, pe->path, pkg);
+
+	TAILQ_FOREACH(pkg, &db->pkg_rm_head, entry) {
+		files = bytes = dirs = kept = shared = 0;
+		TAILQ_FOREACH(pe, &pkg->pe_head, entry) {
+			if (rej_match(db, pe->rpath) > 0 ||
+			    lstat(pe->path, &sb) < 0) {
+				kept++;
+				continue;
+			}
+			if (S_ISDIR(sb.st_mode)) {
+				if (fflag == 1 && !htab_get(links, pe->path))
+					dirs++;
+				else
+					kept++;
+				continue;
+			}
+			if (S_ISLNK(sb.st_mode) && fflag == 0) {
+				kept++;
+				continue;
+			}
+			if (htab_get(links, pe->path))
+				shared++;
+			files++;
+			if (S_ISREG(sb.st_mode))
+				bytes += sb.st_size;
+		}
+		printf("remove %s: %llu files, %llu bytes, %llu directories, "
+		       "%llu kept, %llu shared\n", strrchr(pkg->path, '/') + 1,
+		       files, bytes, dirs, kept, shared);
+		tfiles += files + dirs;
+		tbytes += bytes;
+		npkgs++;
 	}
-	return 0;
+	printf("total: %llu packages, %llu files, %llu bytes, roughly %.1fs (guess)\n",
+	       npkgs, tfiles, tbytes, prof_estimate(PROF_REMOVE, tbytes, tfiles));
+	htab_free(links);
 }
@@ -0,0 +1,148 @@
+/* See LICENSE file for copyright and license details. */
+#include <sys/statvfs.h>
+#include "pkg.h"
+
+/*
+ * Estimate the blocks and inodes a set of packages needs on each
+ * filesystem below the installation roots, from the sizes recorded
+ * by pkg_load_file(), and compare them with what statvfs() reports
+ * as available.  Entries which already exist are counted by the
+ * growth of their size only, and entries shipped by several packages,
+ * such as their common directories, only once.
+ */
+
+struct fs {
+	dev_t dev;
+	char path[PATH_MAX];		/* a path on the filesystem */
+	unsigned long bsize;		/* fragment size */
+	unsigned long long blocks;	/* blocks needed */
+	unsigned long long inodes;	/* inodes needed */
+	struct fs *next;
+};
+
+struct fsctx {
+	struct fs *head;
+	char last[PATH_MAX];		/* directory of the last lookup */
+	struct fs *lastfs;
+};
+
+static struct fs *
+fs_get(struct fsctx *ctx, dev_t dev, const char *path)
+{
+	struct statvfs vfs;
+	struct fs *fs;
+
+	for (fs = ctx->head; fs; fs = fs->next)
+		if (fs->dev == dev)
+			return fs;
+	fs = ecalloc(1, sizeof(*fs));
+	fs->dev = dev;
+	estrlcpy(fs->path, path, sizeof(fs->path));
+	fs->bsize = statvfs(path, &vfs) == 0 && vfs.f_frsize ? vfs.f_frsize : 512;
+	fs->next = ctx->head;
+	ctx->head = fs;
+	return fs;
+}
+
+/* Find the filesystem `path' will be created on, from its nearest
+ * existing ancestor.  The last lookup is cached since the entries of
+ * an archive come grouped by directory. */
+static struct fs *
+fs_lookup(struct fsctx *ctx, const char *path)
+{
+	struct stat sb;
+	char dir[PATH_MAX], *p;
+
+	estrlcpy(dir, path, sizeof(dir));
+	if ((p = strrchr(dir, '/')) && p != dir)
+		*p = '\0';
+	if (ctx->lastfs && strcmp(dir, ctx->last) == 0)
+		return ctx->lastfs;
+	estrlcpy(ctx->last, dir, sizeof(ctx->last));
+
+	while (stat(dir, &sb) < 0) {
+		if (!(p = strrchr(dir, '/')) || p == dir) {
+			estrlcpy(dir, "/", sizeof(dir));
+			if (stat(dir, &sb) < 0)
+				return ctx->lastfs = NULL;
+			break;
+		}
+		*p = '\0';
+	}
+	return ctx->lastfs = fs_get(ctx, sb.st_dev, dir);
+}
+
+static unsigned long long
+blocks(off_t size, unsigned long bsize)
+{
+	return ((unsigned long long)size + bsize - 1) / bsize;
+}
+
+/* Check that the packages in `head' fit into the `n' roots of
+ * `dbs'.  Returns -1 if any filesystem is too small. */
+int
+space_check(struct db **dbs, int n, struct pkg_head *head)
+{
+	struct statvfs vfs;
+	struct fsctx ctx;
+	struct fs *fs, *tmp;
+	struct pkg *pkg;
+	struct pkgentry *pe;
+	struct stat sb;
+	struct htab *seen;
+	unsigned long long old;
+	char path[PATH_MAX];
+	int i, r = 0;
+
+	memset(&ctx, 0, sizeof(ctx));
+	for (i = 0; i < n; i++) {
+		seen = htab_new(1024);
+		TAILQ_FOREACH(pkg, head, entry) {
+			TAILQ_FOREACH(pe, &pkg->pe_head, entry) {
+				if (htab_get(seen, pe->rpath))
+					continue;
+				htab_add(seen, pe->rpath, pe);
+				db_entry_path(dbs[i], pe->rpath, path, sizeof(path));
+				if (lstat(path, &sb) == 0) {
+					fs = fs_get(&ctx, sb.st_dev, path);
+					old = S_ISREG(sb.st_mode) ? blocks(sb.st_size, fs->bsize) : 0;
+					if (blocks(pe->size, fs->bsize) > old)
+						fs->blocks += blocks(pe->size, fs->bsize) - old;
+					continue;
+				}
+				if (!(fs = fs_lookup(&ctx, path)))
+					continue;
+				fs->blocks += blocks(pe->size, fs->bsize);
+				fs->inodes++;
+			}
+		}
+		htab_free(seen);
+		/* the db record and its metadata */
+		if ((fs = fs_lookup(&ctx, dbs[i]->path))) {
+			TAILQ_FOREACH(pkg, head, entry) {
+				fs->blocks += 2;
+				fs->inodes += 2;
+			}
+		}
+	}
+
+	for (fs = ctx.head; fs; fs = tmp) {
+		tmp = fs->next;
+		if (statvfs(fs->path, &vfs) < 0) {
+			weprintf("statvfs %s:", fs->path);
+		} else if (fs->blocks > vfs.f_bavail ||
+			   (vfs.f_files > 0 && fs->inodes > vfs.f_favail)) {
+			weprintf("%s: need %llu KiB and %llu inodes, "
+				 "%llu KiB and %llu inodes available\n", fs->path,
+				 fs->blocks * fs->bsize / 1024, fs->inodes,
+				 (unsigned long long)vfs.f_bavail * fs->bsize / 1024,
+				 (unsigned long long)vfs.f_favail);
+			r = -1;
+		} else if (vflag == 1) {
+			printf("%s: need %llu KiB and %llu inodes\n", fs->path,
+			       fs->blocks * fs->bsize / 1024, fs->inodes);
+		}
+		free(fs);
+	}
+	return r;
+}
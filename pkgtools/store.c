@@ -0,0 +1,244 @@
+/* See LICENSE file for copyright and license details. */
+#include <fcntl.h>
+#include "pkg.h"
+
+/*
+ * Content addressed object store.  If DBPATH/DBPATHOBJECTS exists,
+ * regular files are extracted once into the store, named after the
+ * SHA-256 of their content and their mode and ownership, and then
+ * hardlinked into place.  Identical files of different packages or
+ * reinstalls of unchanged files share one inode, so these files are
+ * read-only: editing one in place changes it in every package and
+ * root linking it.  Files below etc/ and var/, which are meant to be
+ * changed, are never stored.  Objects whose only remaining link is
+ * the store itself are removed by store_gc().
+ */
+
+/* Build the path of the store of `db' */
+static void
+store_dir(struct db *db, char *path, size_t sz)
+{
+	estrlcpy(path, db->path, sz);
+	estrlcat(path, "/" DBPATHOBJECTS, sz);
+}
+
+/* Create the missing parent directories of `path' */
+static int
+mkparents(const char *path)
+{
+	char tmp[PATH_MAX], *p;
+
+	estrlcpy(tmp, path, sizeof(tmp));
+	for (p = tmp + 1; (p = strchr(p, '/')); p++) {
+		*p = '\0';
+		if (mkdir(tmp, 0755) < 0 && errno != EEXIST)
+			return -1;
+		*p = '/';
+	}
+	return 0;
+}
+
+int
+store_enabled(struct db *db)
+{
+	char path[PATH_MAX];
+	struct stat sb;
+
+	store_dir(db, path, sizeof(path));
+	return stat(path, &sb) == 0 && S_ISDIR(sb.st_mode);
+}
+
+/* Whether the entry `rpath' may be shared with other packages.
+ * Configuration files and state are edited in place and must not
+ * be. */
+int
+store_eligible(struct archive_entry *entry, const char *rpath)
+{
+	return archive_entry_filetype(entry) == AE_IFREG &&
+	       !archive_entry_hardlink(entry) &&
+	       strncmp(rpath, "etc/", 4) != 0 &&
+	       strncmp(rpath, "var/", 4) != 0;
+}
+
+/* Build the path of object `key' in the store of `db' */
+void
+store_path(struct db *db, const char *key, char *path, size_t sz)
+{
+	char sub[3] = { key[0], key[1], '\0' };
+
+	store_dir(db, path, sz);
+	estrlcat(path, "/", sz);
+	estrlcat(path, sub, sz);
+	estrlcat(path, "/", sz);
+	estrlcat(path, key + 2, sz);
+}
+
+static void
+hash_zeros(struct sha256 *s, int64_t n)
+{
+	static const char zeros[BUFSIZ];
+
+	for (; n > (int64_t)sizeof(zeros); n -= sizeof(zeros))
+		sha256_update(s, zeros, sizeof(zeros));
+	if (n > 0)
+		sha256_update(s, zeros, n);
+}
+
+/* Extract the data of the current entry of `ar' into the store of
+ * `db'.  The key of the object is returned in `key', which must
+ * hold at least STOREKEYLEN bytes. */
+int
+store_spool(struct db *db, struct archive *ar, struct archive_entry *entry,
+	    char *key)
+{
+	struct sha256 s;
+	struct timespec ts[2];
+	char tmp[PATH_MAX], path[PATH_MAX], hex[SHA256_HEXLEN + 1];
+	const void *buf;
+	size_t size;
+	int64_t offset, pos = 0;
+	int fd, r;
+
+	store_dir(db, tmp, sizeof(tmp));
+	estrlcat(tmp, "/.tmp.XXXXXX", sizeof(tmp));
+	if ((fd = mkstemp(tmp)) < 0) {
+		weprintf("mkstemp %s:", tmp);
+		return -1;
+	}
+
+	sha256_init(&s);
+	while ((r = archive_read_data_block(ar, &buf, &size, &offset)) == ARCHIVE_OK) {
+		/* holes of sparse files hash as zeros */
+		hash_zeros(&s, offset - pos);
+		sha256_update(&s, buf, size);
+		if (pwrite(fd, buf, size, offset) != (ssize_t)size) {
+			weprintf("pwrite %s:", tmp);
+			goto err;
+		}
+		pos = offset + size;
+	}
+	if (r != ARCHIVE_EOF) {
+		weprintf("archive_read_data_block: %s\n", archive_error_string(ar));
+		goto err;
+	}
+	hash_zeros(&s, archive_entry_size(entry) - pos);
+	if (ftruncate(fd, archive_entry_size(entry)) < 0) {
+		weprintf("ftruncate %s:", tmp);
+		goto err;
+	}
+	sha256_hex(&s, hex);
+
+	if (geteuid() == 0 &&
+	    fchown(fd, archive_entry_uid(entry), archive_entry_gid(entry)) < 0)
+		weprintf("fchown %s:", tmp);
+	if (fchmod(fd, archive_entry_perm(entry)) < 0)
+		weprintf("fchmod %s:", tmp);
+	ts[0].tv_sec = ts[1].tv_sec = archive_entry_mtime(entry);
+	ts[0].tv_nsec = ts[1].tv_nsec = archive_entry_mtime_nsec(entry);
+	if (futimens(fd, ts) < 0)
+		weprintf("futimens %s:", tmp);
+	close(fd);
+
+	snprintf(key, STOREKEYLEN, "%s.%o.%ld.%ld", hex,
+		 (unsigned)archive_entry_perm(entry),
+		 (long)archive_entry_uid(entry), (long)archive_entry_gid(entry));
+	store_path(db, key, path, sizeof(path));
+	/* an object which is already stored, possibly by a concurrent
+	 * install, is kept so that all links share its inode */
+	if (mkparents(path) < 0 || (link(tmp, path) < 0 && errno != EEXIST)) {
+		weprintf("link %s:", path);
+		unlink(tmp);
+		return -1;
+	}
+	unlink(tmp);
+	return 0;
+
+err:
+	close(fd);
+	unlink(tmp);
+	return -1;
+}
+
+/* Make sure object `key' exists in the store of `db', linking it
+ * from `src' in another store if necessary */
+int
+store_import(struct db *db, const char *key, const char *src)
+{
+	char path[PATH_MAX];
+
+	store_path(db, key, path, sizeof(path));
+	if (mkparents(path) < 0 || (link(src, path) < 0 && errno != EEXIST))
+		return -1;
+	return 0;
+}
+
+/* Hardlink object `key' of the store of `db' to `target' */
+int
+store_link(struct db *db, const char *key, const char *target)
+{
+	char path[PATH_MAX];
+	struct stat sb1, sb2;
+
+	store_path(db, key, path, sizeof(path));
+	if (lstat(path, &sb1) < 0)
+		return -1;
+	if (lstat(target, &sb2) == 0) {
+		/* unchanged file of a reinstall */
+		if (sb1.st_dev == sb2.st_dev && sb1.st_ino == sb2.st_ino)
+			return 0;
+		if (S_ISDIR(sb2.st_mode) || unlink(target) < 0)
+			return -1;
+	}
+	if (link(path, target) == 0)
+		return 0;
+	if (errno != ENOENT || mkparents(target) < 0)
+		return -1;
+	return link(path, target);
+}
+
+/* Remove objects which are no longer linked from any root */
+int
+store_gc(struct db *db)
+{
+	DIR *dir, *sub;
+	struct dirent *dp, *sp;
+	struct stat sb;
+	char path[PATH_MAX], spath[PATH_MAX], opath[PATH_MAX];
+
+	store_dir(db, path, sizeof(path));
+	if (!(dir = opendir(path))) {
+		weprintf("opendir %s:", path);
+		return -1;
+	}
+	while ((dp = readdir(dir))) {
+		if (strcmp(dp->d_name, ".") == 0 || strcmp(dp->d_name, "..") == 0)
+			continue;
+		estrlcpy(spath, path, sizeof(spath));
+		estrlcat(spath, "/", sizeof(spath));
+		estrlcat(spath, dp->d_name, sizeof(spath));
+		/* leftover of an interrupted store_spool() */
+		if (strncmp(dp->d_name, ".tmp.", 5) == 0) {
+			unlink(spath);
+			continue;
+		}
+		if (!(sub = opendir(spath)))
+			continue;
+		while ((sp = readdir(sub))) {
+			if (sp->d_name[0] == '.')
+				continue;
+			estrlcpy(opath, spath, sizeof(opath));
+			estrlcat(opath, "/", sizeof(opath));
+			estrlcat(opath, sp->d_name, sizeof(opath));
+			if (lstat(opath, &sb) < 0 || sb.st_nlink > 1)
+				continue;
+			if (vflag == 1)
+				printf("removing %s\n", opath);
+			if (unlink(opath) < 0)
+				weprintf("unlink %s:", opath);
+		}
+		closedir(sub);
+		rmdir(spath);
+	}
+	closedir(dir);
+	return 0;
+}